@@ -0,0 +1,266 @@
+/*!
+ * @file audiokernel.cpp
+ * @brief Implements the vectorized audio kernels and their dispatch
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <cstdlib>
+#include <cstring>
+#include "audiokernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNEL_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define KERNEL_NEON
+#include <arm_neon.h>
+#endif
+
+/* The scalar loops must round the product before adding it, as the
+ * vector variants do, where the compiler would contract them to fused
+ * multiply-adds */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+typedef void (*ScaleCopyFunc)(float *, const float *, float, uint32_t);
+typedef void (*ScaleAddFunc)(float *, const float *, float, uint32_t);
+typedef void (*ZeroFunc)(float *, uint32_t);
+
+struct AudioKernel {
+    const char *name;
+    ScaleCopyFunc scaleCopy;
+    ScaleAddFunc scaleAdd;
+    ZeroFunc zero;
+};
+
+static void scaleCopyScalar(float *dst, const float *src, float gain, uint32_t nframes)
+{
+    for (uint32_t f = 0; f < nframes; f++) {
+        dst[f] = src[f] * gain;
+    }
+}
+
+static void scaleAddScalar(float *dst, const float *src, float gain, uint32_t nframes)
+{
+    for (uint32_t f = 0; f < nframes; f++) {
+        dst[f] += src[f] * gain;
+    }
+}
+
+static void zeroScalar(float *dst, uint32_t nframes)
+{
+    for (uint32_t f = 0; f < nframes; f++) {
+        dst[f] = 0.0f;
+    }
+}
+
+#ifdef KERNEL_X86
+__attribute__((target("sse")))
+static void scaleCopySse(float *dst, const float *src, float gain, uint32_t nframes)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    uint32_t f = 0;
+
+    for (; f + 4 <= nframes; f += 4) {
+        _mm_storeu_ps(dst + f, _mm_mul_ps(_mm_loadu_ps(src + f), g));
+    }
+    for (; f < nframes; f++) {
+        dst[f] = src[f] * gain;
+    }
+}
+
+__attribute__((target("sse")))
+static void scaleAddSse(float *dst, const float *src, float gain, uint32_t nframes)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    uint32_t f = 0;
+
+    for (; f + 4 <= nframes; f += 4) {
+        const __m128 p = _mm_mul_ps(_mm_loadu_ps(src + f), g);
+        _mm_storeu_ps(dst + f, _mm_add_ps(_mm_loadu_ps(dst + f), p));
+    }
+    for (; f < nframes; f++) {
+        dst[f] += src[f] * gain;
+    }
+}
+
+__attribute__((target("sse")))
+static void zeroSse(float *dst, uint32_t nframes)
+{
+    const __m128 z = _mm_setzero_ps();
+    uint32_t f = 0;
+
+    for (; f + 4 <= nframes; f += 4) {
+        _mm_storeu_ps(dst + f, z);
+    }
+    for (; f < nframes; f++) {
+        dst[f] = 0.0f;
+    }
+}
+
+__attribute__((target("avx")))
+static void scaleCopyAvx(float *dst, const float *src, float gain, uint32_t nframes)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    uint32_t f = 0;
+
+    for (; f + 8 <= nframes; f += 8) {
+        _mm256_storeu_ps(dst + f, _mm256_mul_ps(_mm256_loadu_ps(src + f), g));
+    }
+    for (; f < nframes; f++) {
+        dst[f] = src[f] * gain;
+    }
+}
+
+__attribute__((target("avx")))
+static void scaleAddAvx(float *dst, const float *src, float gain, uint32_t nframes)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    uint32_t f = 0;
+
+    for (; f + 8 <= nframes; f += 8) {
+        const __m256 p = _mm256_mul_ps(_mm256_loadu_ps(src + f), g);
+        _mm256_storeu_ps(dst + f, _mm256_add_ps(_mm256_loadu_ps(dst + f), p));
+    }
+    for (; f < nframes; f++) {
+        dst[f] += src[f] * gain;
+    }
+}
+
+__attribute__((target("avx")))
+static void zeroAvx(float *dst, uint32_t nframes)
+{
+    const __m256 z = _mm256_setzero_ps();
+    uint32_t f = 0;
+
+    for (; f + 8 <= nframes; f += 8) {
+        _mm256_storeu_ps(dst + f, z);
+    }
+    for (; f < nframes; f++) {
+        dst[f] = 0.0f;
+    }
+}
+#endif
+
+#ifdef KERNEL_NEON
+static void scaleCopyNeon(float *dst, const float *src, float gain, uint32_t nframes)
+{
+    const float32x4_t g = vdupq_n_f32(gain);
+    uint32_t f = 0;
+
+    for (; f + 4 <= nframes; f += 4) {
+        vst1q_f32(dst + f, vmulq_f32(vld1q_f32(src + f), g));
+    }
+    for (; f < nframes; f++) {
+        dst[f] = src[f] * gain;
+    }
+}
+
+static void scaleAddNeon(float *dst, const float *src, float gain, uint32_t nframes)
+{
+    const float32x4_t g = vdupq_n_f32(gain);
+    uint32_t f = 0;
+
+    for (; f + 4 <= nframes; f += 4) {
+        const float32x4_t p = vmulq_f32(vld1q_f32(src + f), g);
+        vst1q_f32(dst + f, vaddq_f32(vld1q_f32(dst + f), p));
+    }
+    for (; f < nframes; f++) {
+        dst[f] += src[f] * gain;
+    }
+}
+
+static void zeroNeon(float *dst, uint32_t nframes)
+{
+    const float32x4_t z = vdupq_n_f32(0.0f);
+    uint32_t f = 0;
+
+    for (; f + 4 <= nframes; f += 4) {
+        vst1q_f32(dst + f, z);
+    }
+    for (; f < nframes; f++) {
+        dst[f] = 0.0f;
+    }
+}
+#endif
+
+static const AudioKernel kernels[] = {
+#ifdef KERNEL_X86
+    {"avx", scaleCopyAvx, scaleAddAvx, zeroAvx},
+    {"sse", scaleCopySse, scaleAddSse, zeroSse},
+#endif
+#ifdef KERNEL_NEON
+    {"neon", scaleCopyNeon, scaleAddNeon, zeroNeon},
+#endif
+    {"scalar", scaleCopyScalar, scaleAddScalar, zeroScalar}
+};
+
+static bool kernelSupported(const AudioKernel &kernel)
+{
+#ifdef KERNEL_X86
+    __builtin_cpu_init();
+    if (!strcmp(kernel.name, "avx")) return __builtin_cpu_supports("avx");
+    if (!strcmp(kernel.name, "sse")) return __builtin_cpu_supports("sse");
+#endif
+    (void)kernel;
+    return true;
+}
+
+/* Runs once when the module is loaded, so run() never initializes it */
+static const AudioKernel *selectKernel()
+{
+    const int count = sizeof(kernels) / sizeof(AudioKernel);
+    const char *forced = getenv("MIDIMET_KERNEL");
+
+    for (int l1 = 0; forced && (l1 < count); l1++) {
+        if (!strcmp(forced, kernels[l1].name) && kernelSupported(kernels[l1])) {
+            return &kernels[l1];
+        }
+    }
+    for (int l1 = 0; l1 < count; l1++) {
+        if (kernelSupported(kernels[l1])) return &kernels[l1];
+    }
+    return &kernels[count - 1];
+}
+
+static const AudioKernel *const kernel = selectKernel();
+
+void audioScaleCopy(float *dst, const float *src, float gain, uint32_t nframes)
+{
+    kernel->scaleCopy(dst, src, gain, nframes);
+}
+
+void audioScaleAdd(float *dst, const float *src, float gain, uint32_t nframes)
+{
+    kernel->scaleAdd(dst, src, gain, nframes);
+}
+
+void audioZero(float *dst, uint32_t nframes)
+{
+    kernel->zero(dst, nframes);
+}
+
+const char *audioKernelName()
+{
+    return kernel->name;
+}
@@ -0,0 +1,48 @@
+/*!
+ * @file audiokernel.h
+ * @brief Declares the vectorized audio kernels used for click playback
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef AUDIOKERNEL_H
+#define AUDIOKERNEL_H
+
+#include <cstdint>
+
+/*
+ * The kernels are picked once when the module is loaded, among AVX and SSE
+ * on x86, NEON on ARM and a scalar fallback. Setting MIDIMET_KERNEL to
+ * "scalar", "sse", "avx" or "neon" in the environment forces a variant,
+ * if the CPU supports it. All variants give the same output bit for bit,
+ * since each output sample is a single multiplication, followed by an
+ * addition for audioScaleAdd() that is never fused with it.
+ */
+
+/*! @brief writes src[i] * gain to dst[i] for i < nframes */
+void audioScaleCopy(float *dst, const float *src, float gain, uint32_t nframes);
+/*! @brief adds src[i] * gain to dst[i] for i < nframes */
+void audioScaleAdd(float *dst, const float *src, float gain, uint32_t nframes);
+/*! @brief writes nframes zeros to dst */
+void audioZero(float *dst, uint32_t nframes);
+/*! @brief returns the name of the kernel variant in use */
+const char *audioKernelName();
+
+#endif
@@ -0,0 +1,102 @@
+/*!
+ * @file clicklayers.cpp
+ * @brief Implements the ClickLayers class of click grids playing along the main click
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include "midimet.h"
+#include "clicklayers.h"
+
+ClickLayers::ClickLayers()
+{
+    for (int l1 = 0; l1 < LAYER_MAX; l1++) {
+        res[l1] = 3;
+        size[l1] = 4;
+        note[l1] = 60 + 2 * l1;
+        channel[l1] = 0;
+        gain[l1] = 0;
+        step[l1] = 0;
+        nextTick[l1] = 0;
+        accent[l1] = false;
+    }
+    next = INT64_MAX;
+}
+
+void ClickLayers::setResolution(int layer, int val)
+{
+    if (res[layer] == val) return;
+
+    res[layer] = val;
+    syncLayer(layer, nextTick[layer]);
+    updateNext();
+}
+
+void ClickLayers::setSize(int layer, int val)
+{
+    size[layer] = val;
+}
+
+void ClickLayers::setGain(int layer, float val, uint64_t tick)
+{
+    if ((gain[layer] <= 0) && (val > 0)) syncLayer(layer, tick);
+    gain[layer] = val;
+    updateNext();
+}
+
+void ClickLayers::setNextTick(uint64_t tick)
+{
+    for (int l1 = 0; l1 < LAYER_MAX; l1++) syncLayer(l1, tick);
+    updateNext();
+}
+
+int ClickLayers::fire(uint64_t tick, int *due)
+{
+    int ndue = 0;
+
+    for (int l1 = 0; l1 < LAYER_MAX; l1++) {
+        if ((gain[l1] <= 0) || ((uint64_t)nextTick[l1] > tick)) continue;
+
+        accent[l1] = !(step[l1] % ((uint64_t)res[l1] * size[l1]));
+        step[l1]++;
+        /* after a jump of the ticks the clicks missed are skipped */
+        if (step[l1] * TPQN / res[l1] <= tick) {
+            step[l1] = tick * res[l1] / TPQN + 1;
+        }
+        nextTick[l1] = step[l1] * TPQN / res[l1];
+        due[ndue++] = l1;
+    }
+    updateNext();
+    return ndue;
+}
+
+/* Places the next click of layer on the first grid tick at or after tick */
+void ClickLayers::syncLayer(int layer, uint64_t tick)
+{
+    step[layer] = (tick * res[layer] + TPQN - 1) / TPQN;
+    nextTick[layer] = step[layer] * TPQN / res[layer];
+}
+
+void ClickLayers::updateNext()
+{
+    next = INT64_MAX;
+    for (int l1 = 0; l1 < LAYER_MAX; l1++) {
+        if ((gain[l1] > 0) && (nextTick[l1] < next)) next = nextTick[l1];
+    }
+}
@@ -0,0 +1,85 @@
+/*!
+ * @file clicklayers.h
+ * @brief Defines the ClickLayers class of click grids playing along the main click
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef CLICKLAYERS_H
+#define CLICKLAYERS_H
+
+#include <cstdint>
+
+/* Click layers besides the main click */
+#define LAYER_MAX       3
+
+/*! @brief Additional click grids on the transport ticks of the main
+ * click, for polyrhythms within one instance.
+ *
+ * Each layer clicks res times per beat and accents the first click of
+ * each cycle of size beats. The settings and the schedule are held as one
+ * array per member, indexed by layer. The tick of a click is computed
+ * from its index since the transport origin, so that resolutions not
+ * dividing TPQN do not drift.
+ *
+ * ClickLayers::next holds the earliest click due across the layers, so
+ * that the run loop compares a single tick per frame however many layers
+ * play, and only the layers due are visited when it is reached.
+ */
+class ClickLayers {
+
+  public:
+    int res[LAYER_MAX];         /*!< Clicks per beat */
+    int size[LAYER_MAX];        /*!< Beats of a cycle */
+    int note[LAYER_MAX];        /*!< MIDI note, an accent plays it an octave higher up to note 115 */
+    int channel[LAYER_MAX];     /*!< MIDI output channel */
+    float gain[LAYER_MAX];      /*!< Velocity factor, 0 turns the layer off */
+
+    uint64_t step[LAYER_MAX];   /*!< Index of the next click since tick 0 */
+    int64_t nextTick[LAYER_MAX];    /*!< Tick of the next click */
+    bool accent[LAYER_MAX];     /*!< True if the last click was accented */
+    int64_t next;       /*!< Earliest nextTick of the layers on, INT64_MAX if none */
+
+    ClickLayers();
+
+/*! @brief sets the clicks per beat of layer, keeping its next click
+ * within one click of where it was */
+    void setResolution(int layer, int val);
+    void setSize(int layer, int val);
+/*! @brief sets the velocity factor of layer. A layer turned on starts
+ * with the first click at or after tick. */
+    void setGain(int layer, float val, uint64_t tick);
+/*! @brief moves the next click of all layers to the first at or after
+ * tick */
+    void setNextTick(uint64_t tick);
+/*! @brief advances the layers with a click due at tick
+ *
+ * @param tick Current tick, at or after ClickLayers::next
+ * @param due Set to the indices of the layers that click
+ * @return Number of layers in due
+ */
+    int fire(uint64_t tick, int *due);
+
+  private:
+    void syncLayer(int layer, uint64_t tick);
+    void updateNext();
+};
+
+#endif
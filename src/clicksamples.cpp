@@ -0,0 +1,280 @@
+/*!
+ * @file clicksamples.cpp
+ * @brief Implements the ClickSamples class of click waves loaded from files
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "config.h"
+#include "clicksamples.h"
+
+#ifdef CONFIG_SNDFILE
+#include <sndfile.h>
+#endif
+
+/* Zero crossings of the interpolation kernel on each side */
+#define SINC_ZEROS      16
+/* Largest sound file read [bytes] */
+#define WAV_MAX_SIZE    (64 << 20)
+
+#ifdef CONFIG_SNDFILE
+
+/* Decodes any format libsndfile reads to mono */
+static bool decodeFile(const std::string& path, std::vector<float>& out,
+                    double *rate, std::string& error)
+{
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+
+    SNDFILE *sf = sf_open(path.c_str(), SFM_READ, &info);
+    if (!sf) {
+        error = path + ": " + sf_strerror(NULL);
+        return false;
+    }
+    if ((info.channels < 1) || (info.samplerate < 1)) {
+        sf_close(sf);
+        error = path + ": no audio";
+        return false;
+    }
+
+    const sf_count_t max_frames = (sf_count_t)info.samplerate
+                                    * CLICK_SAMPLE_MAX_SECONDS;
+    const sf_count_t nframes = (info.frames < max_frames) ? info.frames
+                                                          : max_frames;
+    std::vector<float> frames((size_t)nframes * info.channels);
+    const sf_count_t nread = sf_readf_float(sf, frames.data(), nframes);
+    sf_close(sf);
+
+    out.assign((size_t)nread, 0.0f);
+    for (sf_count_t l1 = 0; l1 < nread; l1++) {
+        float sum = 0;
+        for (int l2 = 0; l2 < info.channels; l2++) {
+            sum += frames[l1 * info.channels + l2];
+        }
+        out[l1] = sum / info.channels;
+    }
+    *rate = info.samplerate;
+    return true;
+}
+
+#else
+
+static uint32_t readLE(const uint8_t *p, int nbytes)
+{
+    uint32_t val = 0;
+
+    for (int l1 = nbytes - 1; l1 >= 0; l1--) val = (val << 8) | p[l1];
+    return val;
+}
+
+/* Returns the sample at p as float, for the sample formats of WAV files */
+static float readSample(const uint8_t *p, int format, int bits)
+{
+    if (format == 3) {
+        if (bits == 32) {
+            float val;
+            memcpy(&val, p, sizeof(val));
+            return val;
+        }
+        double val;
+        memcpy(&val, p, sizeof(val));
+        return (float)val;
+    }
+    switch (bits) {
+        case 8:
+            return (p[0] - 128) / 128.0f;
+        case 16:
+            return (int16_t)readLE(p, 2) / 32768.0f;
+        case 24:
+            /* sign extended through the top byte */
+            return (int32_t)(readLE(p, 3) << 8) / 2147483648.0f;
+        default:
+            return (int32_t)readLE(p, 4) / 2147483648.0f;
+    }
+}
+
+/* Decodes a RIFF WAVE file with integer or float samples to mono */
+static bool decodeFile(const std::string& path, std::vector<float>& out,
+                    double *rate, std::string& error)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    std::vector<uint8_t> file;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        file.insert(file.end(), buf, buf + n);
+        if (file.size() > WAV_MAX_SIZE) break;
+    }
+    fclose(f);
+
+    const uint8_t *p = file.data();
+    const size_t size = file.size();
+    if ((size < 12) || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4)) {
+        error = path + ": not a WAV file, FLAC and other formats need "
+                "the build with libsndfile";
+        return false;
+    }
+
+    int format = 0, channels = 0, bits = 0;
+    const uint8_t *data = NULL;
+    size_t data_size = 0;
+
+    /* chunks are word aligned */
+    for (size_t pos = 12; pos + 8 <= size; ) {
+        const uint32_t chunk_size = readLE(p + pos + 4, 4);
+        const uint8_t *chunk = p + pos + 8;
+        const size_t avail = size - pos - 8;
+
+        if (!memcmp(p + pos, "fmt ", 4) && (chunk_size >= 16)
+                && (avail >= 16)) {
+            format = readLE(chunk, 2);
+            channels = readLE(chunk + 2, 2);
+            *rate = readLE(chunk + 4, 4);
+            bits = readLE(chunk + 14, 2);
+            /* WAVE_FORMAT_EXTENSIBLE, the format is in the sub format */
+            if ((format == 0xfffe) && (chunk_size >= 26) && (avail >= 26)) {
+                format = readLE(chunk + 24, 2);
+            }
+        }
+        else if (!memcmp(p + pos, "data", 4)) {
+            data = chunk;
+            data_size = (chunk_size < avail) ? chunk_size : avail;
+        }
+        pos += 8 + (size_t)chunk_size + (chunk_size & 1);
+    }
+
+    const bool pcm = (format == 1) && ((bits == 8) || (bits == 16)
+                        || (bits == 24) || (bits == 32));
+    const bool ieee = (format == 3) && ((bits == 32) || (bits == 64));
+    if (!data || (channels < 1) || (*rate < 1) || !(pcm || ieee)) {
+        error = path + ": unsupported WAV format";
+        return false;
+    }
+
+    const size_t frame_size = (size_t)channels * bits / 8;
+    size_t nframes = data_size / frame_size;
+    const size_t max_frames = (size_t)*rate * CLICK_SAMPLE_MAX_SECONDS;
+    if (nframes > max_frames) nframes = max_frames;
+
+    out.assign(nframes, 0.0f);
+    for (size_t l1 = 0; l1 < nframes; l1++) {
+        float sum = 0;
+        for (int l2 = 0; l2 < channels; l2++) {
+            sum += readSample(data + l1 * frame_size + l2 * bits / 8,
+                                format, bits);
+        }
+        out[l1] = sum / channels;
+    }
+    return true;
+}
+
+#endif
+
+/* Converts in from in_rate to out_rate with a Blackman windowed sinc
+ * kernel. The cutoff follows the lower of both rates. */
+static void resample(const std::vector<float>& in, double in_rate,
+                    double out_rate, std::vector<float>& out)
+{
+    if (in_rate == out_rate) {
+        out = in;
+        return;
+    }
+
+    const double ratio = out_rate / in_rate;
+    const double cutoff = (ratio < 1) ? ratio : 1;
+    const int half = (int)ceil(SINC_ZEROS / cutoff);
+    const size_t nout = (size_t)ceil(in.size() * ratio);
+    const int64_t nin = in.size();
+
+    out.assign(nout, 0.0f);
+    for (size_t l1 = 0; l1 < nout; l1++) {
+        const double t = l1 / ratio;
+        const int64_t center = (int64_t)floor(t);
+        double sum = 0;
+
+        for (int64_t k = center - half + 1; k <= center + half; k++) {
+            if ((k < 0) || (k >= nin)) continue;
+            const double x = t - k;
+            const double w = x / half;
+            if (fabs(w) >= 1) continue;
+            const double window = 0.42 + 0.5 * cos(M_PI * w)
+                                    + 0.08 * cos(2 * M_PI * w);
+            const double arg = M_PI * cutoff * x;
+            const double sinc = (fabs(arg) < 1e-9) ? 1 : sin(arg) / arg;
+            sum += in[k] * cutoff * sinc * window;
+        }
+        out[l1] = (float)sum;
+    }
+}
+
+/* Loads path into wave at sample_rate */
+static bool loadWave(const std::string& path, double sample_rate,
+                    std::vector<float>& wave, std::string& error)
+{
+    std::vector<float> decoded;
+    double rate = 0;
+
+    if (!decodeFile(path, decoded, &rate, error)) return false;
+    if (decoded.empty()) {
+        error = path + ": no audio";
+        return false;
+    }
+    resample(decoded, rate, sample_rate, wave);
+    return true;
+}
+
+bool ClickSamples::load(const std::string& path,
+                    const std::string& accent_path, const ClickTable *table,
+                    double sample_rate, std::string& error)
+{
+    if (path.empty()) {
+        if (accent_path.empty()) {
+            error = "no click file";
+            return false;
+        }
+        /* only the accent is replaced */
+        waveL.clear();
+        if (table) waveL.assign(table->waveL, table->waveL + table->len);
+    }
+    else if (!loadWave(path, sample_rate, waveL, error)) {
+        return false;
+    }
+
+    if (accent_path.empty()) {
+        waveH = waveL;
+    }
+    else if (!loadWave(accent_path, sample_rate, waveH, error)) {
+        return false;
+    }
+
+    len = (waveH.size() > waveL.size()) ? waveH.size() : waveL.size();
+    waveH.resize(len, 0.0f);
+    waveL.resize(len, 0.0f);
+    audibleH = clickAudibleLength(waveH.data(), len);
+    audibleL = clickAudibleLength(waveL.data(), len);
+    return true;
+}
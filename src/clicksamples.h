@@ -0,0 +1,77 @@
+/*!
+ * @file clicksamples.h
+ * @brief Defines the ClickSamples class of click waves loaded from files
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef CLICKSAMPLES_H
+#define CLICKSAMPLES_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "clicktable.h"
+
+/* Longest click taken from a file [s], the rest is cut off */
+#define CLICK_SAMPLE_MAX_SECONDS    4
+
+/*! @brief Accented and plain click waves decoded from sound files, used
+ * in place of the ClickTable waves.
+ *
+ * The files are mixed down to mono and converted to the sample rate of
+ * the plugin with a windowed sinc interpolator. WAV files are read
+ * directly, other formats such as FLAC need the build with libsndfile.
+ * Both waves have the same length, the shorter one is padded with
+ * silence, so that they play through the same code as the ClickTable
+ * waves.
+ *
+ * Loading reads files and allocates, it is done by the worker or the
+ * state restore, never in run().
+ */
+class ClickSamples {
+
+  public:
+    std::vector<float> waveH;   /*!< Accented click */
+    std::vector<float> waveL;   /*!< Plain click */
+    uint32_t len;       /*!< Frames of both waves */
+    uint32_t audibleH;  /*!< clickAudibleLength() of waveH */
+    uint32_t audibleL;  /*!< clickAudibleLength() of waveL */
+
+    ClickSamples() : len(0), audibleH(0), audibleL(0) {}
+
+/*! @brief loads the clicks for sample_rate
+ *
+ * @param path File of the plain click, if empty the plain click of table
+ * is used, or silence without table
+ * @param accent_path File of the accented click, if empty the plain click
+ * is used for both
+ * @param table ClickTable at sample_rate providing the plain click
+ * @param sample_rate Rate to convert the files to
+ * @param error Set to the reason if loading fails
+ * @return False if a file cannot be read or holds no audio, or if both
+ * paths are empty
+ */
+    bool load(const std::string& path, const std::string& accent_path,
+                const ClickTable *table, double sample_rate,
+                std::string& error);
+};
+
+#endif
@@ -0,0 +1,162 @@
+/*!
+ * @file clicksynth.cpp
+ * @brief Implements the ClickSynth real-time click synthesizer.
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <cmath>
+#include "clicksynth.h"
+
+/* sin(x), reduced to [-pi, pi] and folded to [-pi/2, pi/2], where the
+ * Taylor polynomial to x^11 is within 6e-8. */
+static inline double sinPoly(double x)
+{
+    x -= 2 * M_PI * nearbyint(x * (0.5 / M_PI));
+    if (x > M_PI_2) x = M_PI - x;
+    if (x < -M_PI_2) x = -M_PI - x;
+
+    const double x2 = x * x;
+    return x * (1. + x2 * (-1. / 6 + x2 * (1. / 120 + x2 * (-1. / 5040
+            + x2 * (1. / 362880 + x2 * (-1. / 39916800))))));
+}
+
+/* Frames until amp decaying by step per frame falls below
+ * CLICK_CULL_LEVEL, at most len */
+static uint32_t cullFrames(double amp, double step, uint32_t len)
+{
+    if (amp < CLICK_CULL_LEVEL) return 0;
+    const double frames = ceil(log(CLICK_CULL_LEVEL / amp) / log(step));
+    return (frames < len) ? (uint32_t)frames : len;
+}
+
+ClickSynth::ClickSynth()
+{
+    len = 0;
+    pos = 0;
+    end = 0;
+    endH = endL = 0;
+    for (int l1 = 0; l1 < 4; l1++) {
+        modRe[l1] = modIm[l1] = 0;
+        modStepRe[l1] = modStepIm[l1] = 0;
+        modInitRe[l1] = 0;
+    }
+    carRe = carIm = carStepRe = carStepIm = 0;
+    env = envStep = 0;
+    wc = wcH = wcL = 0;
+    ampH = ampL = 0;
+}
+
+void ClickSynth::init(double sample_rate, const ClickParams &params)
+{
+    const float *FH = params.fh;
+    const float *FL = params.fl;
+    const int *A = params.a;
+    const float *T = params.t;
+
+    len = (int)(30 * T[0] * sample_rate);
+    pos = len;
+
+    for (int l1 = 0; l1 < 4; l1++) {
+        /* as in ClickTable, modulator frequencies scale with FH[0] */
+        const double w = FH[l1 + 1] * M_PI * FH[0] / sample_rate;
+        const double decay = exp(-1. / len / T[l1 + 1]);
+        modStepRe[l1] = decay * cos(w);
+        modStepIm[l1] = decay * sin(w);
+        modInitRe[l1] = A[l1 + 1];
+    }
+    wcH = 2 * M_PI * FH[0] / sample_rate;
+    wcL = 2 * M_PI * FL[0] / sample_rate;
+    ampH = A[0] * params.amp;
+    ampL = A[0] * params.amp * 2;
+    envStep = exp(-1. / len / T[0]);
+
+    /* the output stays within the carrier envelope */
+    endH = cullFrames(ampH, envStep, len);
+    endL = cullFrames(ampL, envStep, len);
+    end = 0;
+}
+
+void ClickSynth::trigger(bool accent)
+{
+    for (int l1 = 0; l1 < 4; l1++) {
+        modRe[l1] = modInitRe[l1];
+        modIm[l1] = 0;
+    }
+    wc = (accent) ? wcH : wcL;
+    carRe = 1;
+    carIm = 0;
+    carStepRe = cos(wc);
+    carStepIm = sin(wc);
+    env = (accent) ? ampH : ampL;
+    end = (accent) ? endH : endL;
+    pos = 0;
+}
+
+void ClickSynth::render(float *output, uint32_t nframes, int vel)
+{
+    synthesize<false>(output, nframes, vel);
+}
+
+void ClickSynth::mix(float *output, uint32_t nframes, int vel)
+{
+    synthesize<true>(output, nframes, vel);
+}
+
+template <bool add>
+void ClickSynth::synthesize(float *output, uint32_t nframes, int vel)
+{
+    uint32_t nclick = 0;
+
+    if (pos < end) {
+        nclick = end - pos;
+        if (nclick > nframes) nclick = nframes;
+    }
+
+    for (uint32_t f = 0; f < nclick; f++) {
+        double fm = 0;
+        for (int l1 = 0; l1 < 4; l1++) {
+            fm += modIm[l1];
+            const double re = modRe[l1] * modStepRe[l1] - modIm[l1] * modStepIm[l1];
+            modIm[l1] = modRe[l1] * modStepIm[l1] + modIm[l1] * modStepRe[l1];
+            modRe[l1] = re;
+        }
+        /* sin(wc * (n + fm)) from the carrier phasor at wc * n */
+        const double x = wc * fm;
+        const double y = carIm * sinPoly(x + M_PI_2) + carRe * sinPoly(x);
+        const float v = (float)(y * env) * vel / 128;
+        if (add) {
+            output[f] += v;
+        }
+        else {
+            output[f] = v;
+        }
+
+        const double re = carRe * carStepRe - carIm * carStepIm;
+        carIm = carRe * carStepIm + carIm * carStepRe;
+        carRe = re;
+        env *= envStep;
+    }
+    if (!add) {
+        for (uint32_t f = nclick; f < nframes; f++) {
+            output[f] = 0.0f;
+        }
+    }
+    pos += nclick;
+}
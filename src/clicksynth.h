@@ -0,0 +1,79 @@
+/*!
+ * @file clicksynth.h
+ * @brief Member definitions for the ClickSynth class.
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef CLICKSYNTH_H
+#define CLICKSYNTH_H
+
+#include <cstdint>
+#include "clicktable.h"
+
+/*! @brief Real-time synthesizer of the FM click held by ClickTable.
+ *
+ * The four modulators and the carrier are recursive oscillators, each
+ * advanced by one complex multiplication per frame, with the decay
+ * envelopes folded into the rotation. The carrier phase modulation is
+ * applied with a polynomial sine. The state takes a few hundred bytes
+ * instead of the two wavetables, and the output stays within 1e-5 of
+ * the ClickTable waves.
+ */
+class ClickSynth {
+
+  public:
+    uint32_t len;       /*!< Number of frames of a click, as in ClickTable */
+    uint32_t pos;       /*!< Frames rendered since the last trigger */
+    uint32_t end;       /*!< Frames of the click until its envelope falls
+                             below CLICK_CULL_LEVEL */
+
+    ClickSynth();
+    void init(double sample_rate, const ClickParams &params = defaultClickParams);
+/*! @brief restarts the click
+ *
+ * @param accent Set to True for the accented click (ClickTable::waveH)
+ */
+    void trigger(bool accent);
+    bool active() const { return (pos < end); }
+/*! @brief writes nframes of the click scaled by vel / 128 to output,
+ * and zeros once the click has ended
+ */
+    void render(float *output, uint32_t nframes, int vel);
+/*! @brief adds nframes of the click scaled by vel / 128 to output */
+    void mix(float *output, uint32_t nframes, int vel);
+
+  private:
+    template <bool add>
+    void synthesize(float *output, uint32_t nframes, int vel);
+
+    double modRe[4], modIm[4];      /*!< Modulator phasors times amplitude */
+    double modStepRe[4], modStepIm[4];
+    double modInitRe[4];
+    double carRe, carIm;            /*!< Carrier phasor */
+    double carStepRe, carStepIm;
+    double env, envStep;            /*!< Carrier envelope times amplitude */
+    double wc;                      /*!< Carrier frequency [rad/frame] */
+    double wcH, wcL;
+    double ampH, ampL;
+    uint32_t endH, endL;
+};
+
+#endif
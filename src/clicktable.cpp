@@ -0,0 +1,313 @@
+/*!
+ * @file clicktable.cpp
+ * @brief Implements the ClickTable wavetable cache.
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include "config.h"
+#include "clicktable.h"
+
+#ifdef CONFIG_CLICK_CACHE
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CLICK_CACHE_MAGIC   0x4b4c434dU  /* "MCLK" in host byte order */
+#define CLICK_CACHE_VERSION 1
+
+/*! @brief Header of a click cache file, followed by the accented and the
+ * normal wave of len floats each
+ */
+struct ClickCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    double sampleRate;
+    uint64_t paramsHash;
+    uint64_t dataHash;
+    uint32_t len;
+    uint32_t floatSize;
+    uint8_t reserved[24];
+};
+#endif
+
+#define FNV_BASIS 14695981039346656037ULL
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t h)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    for (size_t l1 = 0; l1 < size; l1++) {
+        h ^= p[l1];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+const ClickParams defaultClickParams = {
+    .5,                                 // amp
+    {880,       1.5,    4,    8,    12},  // FH [Hz]
+    {440,       1.5,    4,    8,    12},  // FL [Hz]
+    {1,   12,      8,    8,    10},       // A
+    // {1,   8,      8,    5,    10},
+    // {1,   0,      0,    0,    0},
+    {.02,     .015,   .01,  .01,  .005}  // T [s]
+};
+
+static std::mutex tableLock;
+static ClickTable *tableList = NULL;
+
+ClickTable::ClickTable(double sample_rate, const ClickParams &p)
+{
+    sampleRate = sample_rate;
+    params = p;
+    hash = paramsHash(p);
+    refCount = 0;
+    next = NULL;
+    mapped = NULL;
+    mappedSize = 0;
+
+    // We are cutting of the wave when time is beyond 30 decay times
+    len = (int)(30 * params.t[0] * sampleRate);
+
+#ifdef CONFIG_CLICK_CACHE
+    char path[PATH_MAX];
+    const bool cached = cachePath(path, sizeof(path));
+    if (cached && loadCache(path)) return;
+#endif
+
+    waveH = (float*)malloc(len * sizeof(float));
+    waveL = (float*)malloc(len * sizeof(float));
+    synthesize();
+
+#ifdef CONFIG_CLICK_CACHE
+    if (cached) saveCache(path);
+#endif
+}
+
+ClickTable::~ClickTable()
+{
+#ifdef CONFIG_CLICK_CACHE
+    if (mapped) {
+        munmap(mapped, mappedSize);
+        return;
+    }
+#endif
+    free(waveH);
+    free(waveL);
+}
+
+void ClickTable::synthesize()
+{
+    //Generate "FM" wave
+    const float amp = params.amp;
+    const float *FH = params.fh;
+    const float *FL = params.fl;
+    const int *A = params.a;
+    const float *T = params.t;
+    const uint32_t npoints = len;
+
+    float *clock_fm = (float*)malloc(npoints * sizeof(float));
+
+    for (uint32_t clock = 0; clock < npoints; clock++) {
+        clock_fm[clock] = clock;
+    }
+    for (uint32_t i = 1; i < 5; i++) {
+        for (uint32_t clock = 0; clock < npoints; clock++) {
+            clock_fm[clock] += (sin((FH[i] * M_PI * FH[0] / sampleRate) * clock) * A[i]) *
+                                exp(-1.* clock / npoints /T[i]);
+        }
+    }
+
+    for (uint32_t clock = 0; clock < npoints; clock++) {
+        waveH[clock] = (sin((2 * M_PI * FH[0] / sampleRate) * clock_fm[clock]) * A[0])
+                        * exp(-1. * clock / npoints /T[0])
+                        * amp;
+        waveL[clock] = (sin((2 * M_PI * FL[0] / sampleRate) * clock_fm[clock]) * A[0])
+                        * exp(-1. * clock / npoints /T[0])
+                        * amp * 2;
+    }
+    free(clock_fm);
+}
+
+#ifdef CONFIG_CLICK_CACHE
+/* $XDG_CACHE_HOME/midimet/click-<rate>-<hash>.bin, with ~/.cache as
+ * default cache directory */
+bool ClickTable::cachePath(char *path, size_t size)
+{
+    char dir[PATH_MAX];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+
+    if (xdg && *xdg) {
+        n = snprintf(dir, sizeof(dir), "%s", xdg);
+    }
+    else if (home && *home) {
+        n = snprintf(dir, sizeof(dir), "%s/.cache", home);
+    }
+    else {
+        return false;
+    }
+    if ((n < 0) || (n >= (int)sizeof(dir) - 9)) return false;
+
+    mkdir(dir, 0755);
+    strcat(dir, "/midimet");
+    mkdir(dir, 0755);
+
+    n = snprintf(path, size, "%s/click-%lu-%016llx.bin", dir,
+                    (unsigned long)lround(sampleRate),
+                    (unsigned long long)hash);
+    return ((n > 0) && (n < (int)size));
+}
+
+/* Maps the cache file and checks it against the expected table, any
+ * mismatch in size, header or data hash rejects it. */
+bool ClickTable::loadCache(const char *path)
+{
+    const size_t data_size = 2 * (size_t)len * sizeof(float);
+    const size_t file_size = sizeof(ClickCacheHeader) + data_size;
+    struct stat st;
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    if ((fstat(fd, &st) < 0) || ((size_t)st.st_size != file_size)) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const ClickCacheHeader *header = (const ClickCacheHeader *)map;
+    float *data = (float *)((uint8_t *)map + sizeof(ClickCacheHeader));
+
+    if ((header->magic != CLICK_CACHE_MAGIC)
+            || (header->version != CLICK_CACHE_VERSION)
+            || (header->sampleRate != sampleRate)
+            || (header->paramsHash != hash)
+            || (header->len != len)
+            || (header->floatSize != sizeof(float))
+            || (header->dataHash != fnv1a(data, data_size,
+                                        FNV_BASIS))) {
+        munmap(map, file_size);
+        return false;
+    }
+    mapped = map;
+    mappedSize = file_size;
+    waveH = data;
+    waveL = data + len;
+    return true;
+}
+
+/* Writes the synthesized waves to a temporary file, which is renamed
+ * over path, so that concurrent readers never see a partial file. */
+void ClickTable::saveCache(const char *path)
+{
+    char tmp[PATH_MAX];
+    ClickCacheHeader header;
+    const size_t wave_size = (size_t)len * sizeof(float);
+
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+        return;
+    }
+    const int fd = mkstemp(tmp);
+    if (fd < 0) return;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = CLICK_CACHE_MAGIC;
+    header.version = CLICK_CACHE_VERSION;
+    header.sampleRate = sampleRate;
+    header.paramsHash = hash;
+    header.len = len;
+    header.floatSize = sizeof(float);
+    header.dataHash = fnv1a(waveL, wave_size,
+                        fnv1a(waveH, wave_size, FNV_BASIS));
+
+    bool ok = (write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header))
+            && (write(fd, waveH, wave_size) == (ssize_t)wave_size)
+            && (write(fd, waveL, wave_size) == (ssize_t)wave_size);
+    fchmod(fd, 0644);
+    ok = (close(fd) == 0) && ok;
+
+    if (!ok || (rename(tmp, path) != 0)) unlink(tmp);
+}
+#endif
+
+uint64_t ClickTable::paramsHash(const ClickParams &params)
+{
+    /* FNV-1a over the parameter values */
+    return fnv1a(&params, sizeof(ClickParams), FNV_BASIS);
+}
+
+uint32_t clickAudibleLength(const float *wave, uint32_t len)
+{
+    while (len && (fabsf(wave[len - 1]) < CLICK_CULL_LEVEL)) len--;
+    return len;
+}
+
+const ClickTable *ClickTable::acquire(double sample_rate,
+                        const ClickParams &params)
+{
+    const uint64_t h = paramsHash(params);
+    std::lock_guard<std::mutex> lock(tableLock);
+
+    ClickTable *table = tableList;
+    while (table) {
+        if ((table->sampleRate == sample_rate) && (table->hash == h)
+                && !memcmp(&table->params, &params, sizeof(ClickParams))) {
+            break;
+        }
+        table = table->next;
+    }
+    if (!table) {
+        table = new ClickTable(sample_rate, params);
+        /* synthesized or mapped from the cache */
+        table->audibleH = clickAudibleLength(table->waveH, table->len);
+        table->audibleL = clickAudibleLength(table->waveL, table->len);
+        table->next = tableList;
+        tableList = table;
+    }
+    table->refCount++;
+    return table;
+}
+
+void ClickTable::release(const ClickTable *table)
+{
+    if (!table) return;
+
+    std::lock_guard<std::mutex> lock(tableLock);
+
+    ClickTable **link = &tableList;
+    while (*link && (*link != table)) link = &(*link)->next;
+    if (!*link) return;
+
+    ClickTable *found = *link;
+    if (--found->refCount > 0) return;
+
+    *link = found->next;
+    delete found;
+}
@@ -0,0 +1,96 @@
+/*!
+ * @file clicktable.h
+ * @brief Member definitions for the ClickTable class.
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef CLICKTABLE_H
+#define CLICKTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* Level below which the tail of a click is cut off, -80 dBFS */
+#define CLICK_CULL_LEVEL    1e-4f
+
+/*! @brief returns the frames of wave up to its last sample at or above
+ * CLICK_CULL_LEVEL */
+uint32_t clickAudibleLength(const float *wave, uint32_t len);
+
+/*! @brief Parameters of the five operator FM click. Index 0 holds the
+ * carrier, indices 1 to 4 the modulators.
+ */
+struct ClickParams {
+    float amp;
+    float fh[5];    /*!< Frequencies of the accented click [Hz] */
+    float fl[5];    /*!< Frequencies of the normal click [Hz] */
+    int   a[5];     /*!< Operator amplitudes */
+    float t[5];     /*!< Operator decay times [s] */
+};
+
+/*! @brief The click sound used by the plugin */
+extern const ClickParams defaultClickParams;
+
+/*! @brief Read-only FM click wavetables shared between plugin instances.
+ *
+ * Tables are synthesized once per sample rate and parameter set and kept
+ * in a process-wide list. When built with CONFIG_CLICK_CACHE, tables are
+ * also stored in the user cache directory and mapped read-only by later
+ * processes instead of being synthesized again. ClickTable::acquire()
+ * returns a reference counted table, ClickTable::release() frees it when
+ * the last instance using it is cleaned up. Both must only be called from instantiation threads,
+ * never from run().
+ */
+class ClickTable {
+
+  public:
+    double sampleRate;
+    uint32_t len;       /*!< Number of frames in each wave */
+    float *waveH;       /*!< Accented click */
+    float *waveL;       /*!< Normal click */
+    uint32_t audibleH;  /*!< clickAudibleLength() of waveH */
+    uint32_t audibleL;  /*!< clickAudibleLength() of waveL */
+
+    static const ClickTable *acquire(double sample_rate,
+                        const ClickParams &params = defaultClickParams);
+    static void release(const ClickTable *table);
+/*! @brief returns a hash of params, which keys the tables together with
+ * the sample rate
+ */
+    static uint64_t paramsHash(const ClickParams &params);
+
+  private:
+    ClickParams params;
+    uint64_t hash;
+    int refCount;
+    ClickTable *next;
+    void *mapped;       /*!< Cache file mapping holding the waves, or NULL */
+    size_t mappedSize;
+
+    ClickTable(double sample_rate, const ClickParams &p);
+    ~ClickTable();
+    void synthesize();
+    bool cachePath(char *path, size_t size);
+    bool loadCache(const char *path);
+    void saveCache(const char *path);
+};
+
+#endif
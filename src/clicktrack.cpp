@@ -0,0 +1,418 @@
+/*!
+ * @file clicktrack.cpp
+ * @brief Implements the ClickTrack class rendering a click track from a tempo map
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include "midimet.h"
+#include "clickvoices.h"
+#include "clicktrack.h"
+
+/* Frames rendered at once before the first frame of a range */
+#define PREROLL_BLOCK   1024
+
+ClickTrack::ClickTrack()
+{
+    res = 1;
+    size = 4;
+    vel = 64;
+    note = 57;
+    channel = 0;
+    noteLength = 60;
+    sampleRate = 0;
+    totalFrames = 0;
+    smfLength = 0;
+    clickLength = 0;
+#ifndef CONFIG_CLICK_SYNTH
+    clickTable = NULL;
+#endif
+}
+
+ClickTrack::~ClickTrack()
+{
+#ifndef CONFIG_CLICK_SYNTH
+    if (clickTable) ClickTable::release(clickTable);
+#endif
+}
+
+static bool parseInt(const std::string& word, int *val)
+{
+    char *end;
+    const long v = strtol(word.c_str(), &end, 10);
+    if ((end == word.c_str()) || *end || (v < 1) || (v > 100000)) return false;
+    *val = (int)v;
+    return true;
+}
+
+static bool parseMeter(const std::string& word, int *beats, int *unit)
+{
+    const size_t slash = word.find('/');
+    if ((slash == std::string::npos)
+            || !parseInt(word.substr(0, slash), beats)
+            || !parseInt(word.substr(slash + 1), unit)) {
+        return false;
+    }
+    /* the MIDI file holds the unit as a power of two */
+    return ((*beats <= 128) && (*unit <= 64) && !(*unit & (*unit - 1)));
+}
+
+bool ClickTrack::parseMap(const std::string& text, std::string& error)
+{
+    std::vector<TempoEntry> entries;
+    std::istringstream in(text);
+    std::string line;
+    TempoEntry entry = {0, 0, 4, 4, 0, RAMP_LINEAR};
+    int nline = 0;
+
+    while (std::getline(in, line)) {
+        nline++;
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+
+        std::istringstream fields(line);
+        std::string word;
+        if (!(fields >> word)) continue;
+
+        const char *reason = NULL;
+        const int prev_bar = entry.bar;
+        entry.rampBars = 0;
+        entry.rampShape = RAMP_LINEAR;
+        if (!entries.empty() && !entries.back().bpm) {
+            reason = "entry after the end";
+        }
+        else if (!parseInt(word, &entry.bar)) {
+            reason = "invalid bar";
+        }
+        else if (entries.empty() ? (entry.bar != 1) : (entry.bar <= prev_bar)) {
+            reason = (entries.empty()) ? "the map must start at bar 1"
+                                       : "bars must increase";
+        }
+        else if (!(fields >> word)) {
+            reason = "missing tempo";
+        }
+        else if (word == "end") {
+            if (entries.empty()) reason = "the map must start with a tempo";
+            entry.bpm = 0;
+            if (fields >> word) reason = "text after end";
+        }
+        else {
+            char *end;
+            entry.bpm = strtod(word.c_str(), &end);
+            if ((end == word.c_str()) || *end || !(entry.bpm >= 1)
+                    || (entry.bpm > 1000)) {
+                reason = "invalid tempo";
+            }
+            while (!reason && (fields >> word)) {
+                if (word == "ramp") {
+                    if (!(fields >> word) || !parseInt(word, &entry.rampBars)) {
+                        reason = "invalid ramp length";
+                    }
+                }
+                else if (word == "linear") {
+                    entry.rampShape = RAMP_LINEAR;
+                }
+                else if (word == "exponential") {
+                    entry.rampShape = RAMP_EXPONENTIAL;
+                }
+                else if (!parseMeter(word, &entry.beatsPerBar,
+                                    &entry.beatUnit)) {
+                    reason = "invalid time signature";
+                }
+            }
+            if (!reason && entries.empty() && entry.rampBars) {
+                reason = "the first tempo cannot ramp";
+            }
+        }
+        if (reason) {
+            error = "line " + std::to_string(nline) + ": " + reason;
+            return false;
+        }
+        entries.push_back(entry);
+    }
+
+    if (entries.empty() || entries.back().bpm) {
+        error = "the map must end with an end entry";
+        return false;
+    }
+    map = entries;
+    return true;
+}
+
+bool ClickTrack::setPattern(const std::string& text)
+{
+    StepPattern p(note);
+
+    if (!p.parse(text.data(), text.size())) return false;
+    program = text;
+    return true;
+}
+
+void ClickTrack::build(double sample_rate)
+{
+    sampleRate = sample_rate;
+    totalFrames = 0;
+    smfLength = 0;
+    clickList.clear();
+    metaList.clear();
+
+#ifdef CONFIG_CLICK_SYNTH
+    ClickSynth synth;
+    synth.init(sample_rate);
+    synth.trigger(true);
+    clickLength = synth.end;
+    synth.trigger(false);
+    if (synth.end > clickLength) clickLength = synth.end;
+#else
+    if (clickTable) ClickTable::release(clickTable);
+    clickTable = ClickTable::acquire(sample_rate);
+    clickLength = std::max(clickTable->audibleH, clickTable->audibleL);
+#endif
+    if (map.empty()) return;
+
+    MidiMet met;
+    StepPattern *p = new StepPattern(note);
+    p->parse(program.data(), program.size());
+    delete met.swapPattern(p);
+    met.updateVelocity(vel);
+    met.updateResolution(res);
+    met.updateSize(size);
+    met.setNextTick(0);
+    met.setTickRate(map[0].bpm, sample_rate);
+    met.anchorTicks(0, 0);
+
+    /* the note length of the plugin */
+    const uint64_t gate = (uint64_t)noteLength * TPQN / 256;
+    uint64_t tick = 0;
+    uint64_t smf_tick = 0;
+    int us_per_quarter = 0;
+
+    for (size_t l1 = 0; l1 + 1 < map.size(); l1++) {
+        const TempoEntry& e = map[l1];
+        const uint64_t bar_ticks = (uint64_t)e.beatsPerBar * TPQN;
+        const uint64_t end_tick = tick + (map[l1 + 1].bar - e.bar) * bar_ticks;
+        /* a beat is a 1/beatUnit note, the MIDI file counts quarters */
+        const uint64_t smf_num = 4 * SMF_PPQN;
+        const uint64_t smf_den = (uint64_t)e.beatUnit * TPQN;
+        auto smfAt = [&](uint64_t t) {
+            return smf_tick + ((t - tick) * smf_num + smf_den / 2) / smf_den;
+        };
+
+        if (l1) {
+            const TempoEntry& prev = map[l1 - 1];
+            const uint64_t frame = met.frameAtTick(tick);
+            if (e.rampBars) {
+                met.rampTicks(frame, e.bpm, e.rampBars * bar_ticks,
+                                e.rampShape, sample_rate);
+            }
+            else if (e.bpm != prev.bpm) {
+                met.reanchorTicks(frame, e.bpm, sample_rate);
+            }
+        }
+        if (!l1 || (e.beatsPerBar != map[l1 - 1].beatsPerBar)
+                || (e.beatUnit != map[l1 - 1].beatUnit)) {
+            const MetaEvent meter = {smf_tick, 0, e.beatsPerBar, e.beatUnit};
+            metaList.push_back(meter);
+        }
+        met.setBarPosition(tick, 0, e.beatsPerBar);
+
+        for (uint64_t step = 0; ; step++) {
+            const uint64_t t = tick + step * TPQN / res;
+            if (t >= end_tick) break;
+            const uint64_t frame = met.frameAtTick(t);
+
+            /* The MIDI file steps the tempo at each click of a ramp, so
+             * that the clicks fall on the frames of the audio */
+            const uint64_t t1 = std::min(tick + (step + 1) * TPQN / res,
+                                        end_tick);
+            const uint64_t f1 = met.frameAtTick(t1);
+            double beat_frames = (double)TPQN * met.tickDiv / met.tickStep;
+            if (met.ramping(frame) || met.ramping(f1)) {
+                beat_frames = ((f1 - met.framesPastTick(f1, t1))
+                            - (frame - met.framesPastTick(frame, t)))
+                            * TPQN / (t1 - t);
+            }
+            int us = (int)lround(beat_frames / sample_rate * 1e6
+                                * e.beatUnit / 4);
+            us = std::min(std::max(us, 1), 0xffffff);
+            if (us != us_per_quarter) {
+                const MetaEvent tempo = {smfAt(t), us, 0, 0};
+                metaList.push_back(tempo);
+                us_per_quarter = us;
+            }
+
+            met.getNextFrame(t);
+            if (met.outFrame[0].muted) continue;
+
+            Click click;
+            click.frame = frame;
+            click.smfTick = smfAt(t);
+            click.smfEnd = smfAt(t + gate);
+            click.note = met.outFrame[0].data;
+            click.vel = met.outFrame[0].value;
+            click.accent = met.accent;
+            clickList.push_back(click);
+        }
+
+        smf_tick = smfAt(end_tick);
+        tick = end_tick;
+    }
+    totalFrames = met.frameAtTick(tick);
+    smfLength = smf_tick;
+}
+
+void ClickTrack::render(float *output, uint64_t frame, uint32_t nframes) const
+{
+    ClickVoices voices;
+#ifdef CONFIG_CLICK_SYNTH
+    voices.init(sampleRate);
+#else
+    voices.setWaves(clickTable->waveH, clickTable->waveL,
+                    clickTable->audibleH, clickTable->audibleL);
+#endif
+    float preroll[PREROLL_BLOCK];
+
+    /* Clicks started up to clickLength before frame may still sound.
+     * Those are started and run up to frame as the whole track would,
+     * the voices of earlier clicks have all ended by then. */
+    const uint64_t from = (frame > clickLength) ? frame - clickLength : 0;
+    std::vector<Click>::const_iterator click = std::lower_bound(
+            clickList.begin(), clickList.end(), from,
+            [](const Click& c, uint64_t f) { return (c.frame < f); });
+    const uint64_t last = frame + nframes;
+    uint64_t pos = frame;
+    if ((click != clickList.end()) && (click->frame < frame)) {
+        pos = click->frame;
+    }
+
+    while (pos < last) {
+        while ((click != clickList.end()) && (click->frame <= pos)) {
+            voices.start(click->frame, click->accent, click->vel);
+            ++click;
+        }
+        uint64_t next = last;
+        if ((click != clickList.end()) && (click->frame < next)) {
+            next = click->frame;
+        }
+        if (pos < frame) {
+            next = std::min(std::min(next, frame), pos + PREROLL_BLOCK);
+            voices.render(preroll, pos, next - pos);
+        }
+        else {
+            voices.render(output + (pos - frame), pos, next - pos);
+        }
+        pos = next;
+    }
+}
+
+/* Appends val as a MIDI variable length quantity */
+static void putVarLen(std::vector<uint8_t>& buf, uint64_t val)
+{
+    uint8_t bytes[10];
+    int n = 0;
+
+    do {
+        bytes[n++] = val & 0x7f;
+        val >>= 7;
+    } while (val);
+    while (n--) buf.push_back(bytes[n] | ((n) ? 0x80 : 0));
+}
+
+static void putBigEndian(std::vector<uint8_t>& buf, uint32_t val, int size)
+{
+    while (size--) buf.push_back((val >> (8 * size)) & 0xff);
+}
+
+std::vector<uint8_t> ClickTrack::smf() const
+{
+    /* meta events, note offs and note ons of the same tick in that
+     * order, so that a note ends before it is played again */
+    struct Event {
+        uint64_t tick;
+        int order;
+        uint8_t msg[7];
+        int len;
+    };
+    std::vector<Event> events;
+    events.reserve(metaList.size() + 2 * clickList.size());
+
+    for (size_t l1 = 0; l1 < metaList.size(); l1++) {
+        const MetaEvent& m = metaList[l1];
+        Event ev = {m.smfTick, 0, {0xff}, 0};
+        if (m.usPerQuarter) {
+            const uint8_t tempo[6] = {0x51, 3, (uint8_t)(m.usPerQuarter >> 16),
+                    (uint8_t)(m.usPerQuarter >> 8), (uint8_t)m.usPerQuarter};
+            std::copy(tempo, tempo + 5, ev.msg + 1);
+            ev.len = 6;
+        }
+        else {
+            int log2_unit = 0;
+            while ((1 << log2_unit) < m.beatUnit) log2_unit++;
+            /* MIDI clocks per beat, 32nd notes per quarter */
+            const uint8_t meter[6] = {0x58, 4, (uint8_t)m.beatsPerBar,
+                    (uint8_t)log2_unit, (uint8_t)(96 / m.beatUnit), 8};
+            std::copy(meter, meter + 6, ev.msg + 1);
+            ev.len = 7;
+        }
+        events.push_back(ev);
+    }
+    for (size_t l1 = 0; l1 < clickList.size(); l1++) {
+        const Click& c = clickList[l1];
+        const Event on = {c.smfTick, 2, {(uint8_t)(0x90 + channel),
+                (uint8_t)c.note, (uint8_t)c.vel}, 3};
+        const Event off = {c.smfEnd, 1, {(uint8_t)(0x80 + channel),
+                (uint8_t)c.note, 127}, 3};
+        events.push_back(on);
+        events.push_back(off);
+    }
+    std::stable_sort(events.begin(), events.end(),
+            [](const Event& a, const Event& b) {
+                return (a.tick < b.tick)
+                        || ((a.tick == b.tick) && (a.order < b.order));
+            });
+
+    std::vector<uint8_t> track;
+    uint64_t tick = 0;
+    for (size_t l1 = 0; l1 < events.size(); l1++) {
+        putVarLen(track, events[l1].tick - tick);
+        track.insert(track.end(), events[l1].msg,
+                    events[l1].msg + events[l1].len);
+        tick = events[l1].tick;
+    }
+    /* the track ends at the end bar, or with the last note off past it */
+    putVarLen(track, (smfLength > tick) ? smfLength - tick : 0);
+    const uint8_t end_of_track[3] = {0xff, 0x2f, 0};
+    track.insert(track.end(), end_of_track, end_of_track + 3);
+
+    std::vector<uint8_t> buf;
+    putBigEndian(buf, 0x4d546864, 4);   /* "MThd" */
+    putBigEndian(buf, 6, 4);
+    putBigEndian(buf, 0, 2);        /* format 0 */
+    putBigEndian(buf, 1, 2);        /* one track */
+    putBigEndian(buf, SMF_PPQN, 2);
+    putBigEndian(buf, 0x4d54726b, 4);   /* "MTrk" */
+    putBigEndian(buf, track.size(), 4);
+    buf.insert(buf.end(), track.begin(), track.end());
+    return buf;
+}
@@ -0,0 +1,142 @@
+/*!
+ * @file clicktrack.h
+ * @brief Defines the ClickTrack class rendering a click track from a tempo map
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef CLICKTRACK_H
+#define CLICKTRACK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "clicktable.h"
+
+/* Ticks per quarter note of the Standard MIDI File, exact for all
+ * resolutions of the plugin but 11 */
+#define SMF_PPQN        5040
+
+/*! @brief One line of the tempo map */
+struct TempoEntry {
+    int bar;            /*!< Bar from which the entry holds, counted from 1 */
+    double bpm;         /*!< Beats per minute, 0 for the end of the track */
+    int beatsPerBar;
+    int beatUnit;       /*!< Note value of a beat, 4 for quarter notes */
+    int rampBars;       /*!< Bars the tempo ramps over to bpm, 0 changes it at once */
+    int rampShape;      /*!< RAMP_LINEAR or RAMP_EXPONENTIAL */
+};
+
+/*! @brief A click of the track */
+struct Click {
+    uint64_t frame;     /*!< Frame at which the click starts */
+    uint64_t smfTick;   /*!< Position in the MIDI file */
+    uint64_t smfEnd;    /*!< Position of the note off in the MIDI file */
+    int note;
+    int vel;
+    bool accent;
+};
+
+/*! @brief Click track of a tempo map, rendered offline.
+ *
+ * The map is a text with one entry per line, each starting with the bar
+ * it holds from and the tempo in beats per minute, e.g.
+ *
+ *     1  120 4/4
+ *     17 96  6/8 ramp 2
+ *     33 end
+ *
+ * followed optionally by the time signature, which holds on until an
+ * entry changes it, and by "ramp", the number of bars and "linear" or
+ * "exponential" for a tempo ramping to the new value from the bar on.
+ * The last entry holds "end" in place of the tempo and ends the track at
+ * that bar. Text after '#' is ignored.
+ *
+ * ClickTrack::build() steps a MidiMet through the map, with the tempo
+ * changes and ramps of its timebase and the accents on the bar downbeats,
+ * and lists every click with its frame. The audio of any range of frames
+ * is then rendered from the list alone. A range starts with the clicks
+ * still sounding at its first frame, run through a ClickVoices pool from
+ * their own start, so that ranges rendered apart, in any order and on
+ * any thread, join into the same samples as the track rendered at once.
+ */
+class ClickTrack {
+
+  public:
+    int res;            /*!< Clicks per beat */
+    int size;           /*!< Beats of the pattern */
+    int vel;
+    int note;           /*!< MIDI note of the plain click */
+    int channel;        /*!< MIDI channel, 0 to 15 */
+    int noteLength;     /*!< Note length control value of the plugin, 0 to 127 */
+
+    ClickTrack();
+    ~ClickTrack();
+
+/*! @brief parses the tempo map text
+ *
+ * @param error Set to the line and the reason if the text is not a valid
+ * map
+ * @return False if the text is not a valid map, the map is then unchanged
+ */
+    bool parseMap(const std::string& text, std::string& error);
+/*! @brief sets the step pattern program, see StepPattern
+ *
+ * @return False if text is not a valid program
+ */
+    bool setPattern(const std::string& text);
+/*! @brief lists the clicks of the map at sample_rate with the settings
+ * above, must be called before rendering
+ */
+    void build(double sample_rate);
+/*! @brief writes the audio of nframes from frame to output. Safe to call
+ * from several threads at once.
+ */
+    void render(float *output, uint64_t frame, uint32_t nframes) const;
+/*! @brief returns the track as a format 0 Standard MIDI File */
+    std::vector<uint8_t> smf() const;
+
+    uint64_t frames() const { return totalFrames; }
+    const std::vector<Click>& clicks() const { return clickList; }
+
+  private:
+    /* a tempo or time signature meta event of the MIDI file */
+    struct MetaEvent {
+        uint64_t smfTick;
+        int usPerQuarter;   /*!< Tempo, 0 for a time signature */
+        int beatsPerBar;
+        int beatUnit;
+    };
+
+    std::vector<TempoEntry> map;
+    std::string program;
+    double sampleRate;
+    uint64_t totalFrames;
+    uint64_t smfLength;     /*!< Ticks of the MIDI file up to the end bar */
+    uint32_t clickLength;   /*!< Frames of the longest click */
+    std::vector<Click> clickList;
+    std::vector<MetaEvent> metaList;
+#ifndef CONFIG_CLICK_SYNTH
+    const ClickTable *clickTable;
+#endif
+};
+
+#endif
@@ -0,0 +1,137 @@
+/*!
+ * @file clickvoices.cpp
+ * @brief Implements the ClickVoices pool of overlapping clicks
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include "audiokernel.h"
+#include "clickvoices.h"
+
+ClickVoices::ClickVoices()
+{
+    nvoices = 0;
+    endFrame = 0;
+    for (int l1 = 0; l1 < VOICE_MAX; l1++) {
+        onFrame[l1] = 0;
+        accent[l1] = false;
+        vel[l1] = 0;
+    }
+#ifndef CONFIG_CLICK_SYNTH
+    waveH = NULL;
+    waveL = NULL;
+    lenH = 0;
+    lenL = 0;
+#endif
+}
+
+#ifdef CONFIG_CLICK_SYNTH
+void ClickVoices::init(double sample_rate)
+{
+    for (int l1 = 0; l1 < VOICE_MAX; l1++) synth[l1].init(sample_rate);
+}
+#else
+void ClickVoices::setWaves(const float *wave_h, const float *wave_l,
+                    uint32_t len_h, uint32_t len_l)
+{
+    waveH = wave_h;
+    waveL = wave_l;
+    lenH = len_h;
+    lenL = len_l;
+
+    endFrame = 0;
+    for (int l1 = 0; l1 < nvoices; l1++) {
+        if (onFrame[l1] + length(l1) > endFrame) {
+            endFrame = onFrame[l1] + length(l1);
+        }
+    }
+}
+#endif
+
+void ClickVoices::start(uint64_t frame, bool accent, int vel)
+{
+    if (nvoices == VOICE_MAX) remove(0);
+
+    const int voice = nvoices++;
+    onFrame[voice] = frame;
+    this->accent[voice] = accent;
+    this->vel[voice] = vel;
+#ifdef CONFIG_CLICK_SYNTH
+    synth[voice].trigger(accent);
+#endif
+    if (frame + length(voice) > endFrame) endFrame = frame + length(voice);
+}
+
+void ClickVoices::render(float *output, uint64_t frame, uint32_t nframes)
+{
+    audioZero(output, nframes);
+
+    for (int l1 = 0; l1 < nvoices; ) {
+        const uint64_t elapsed = frame - onFrame[l1];
+        const uint32_t len = length(l1);
+        if (elapsed < len) {
+#ifdef CONFIG_CLICK_SYNTH
+            /* the synthesizer is at elapsed, it stops at len by itself */
+            synth[l1].mix(output, nframes, vel[l1]);
+#else
+            const float* const wave = (accent[l1]) ? waveH : waveL;
+            uint32_t nclick = len - elapsed;
+            if (nclick > nframes) nclick = nframes;
+            /* vel / 128 is exact, so this matches wave * vel / 128 bit
+             * for bit */
+            audioScaleAdd(output, wave + elapsed, vel[l1] / 128.f, nclick);
+#endif
+            if (elapsed + nframes < len) {
+                l1++;
+                continue;
+            }
+        }
+        remove(l1);
+    }
+}
+
+void ClickVoices::shift(int64_t delta)
+{
+    for (int l1 = 0; l1 < nvoices; l1++) onFrame[l1] += delta;
+    endFrame += delta;
+}
+
+/* Frames of the click of voice up to the culling level */
+uint32_t ClickVoices::length(int voice) const
+{
+#ifdef CONFIG_CLICK_SYNTH
+    return synth[voice].end;
+#else
+    return (accent[voice]) ? lenH : lenL;
+#endif
+}
+
+/* Removes voice keeping the order of the others */
+void ClickVoices::remove(int voice)
+{
+    for (int l1 = voice + 1; l1 < nvoices; l1++) {
+        onFrame[l1 - 1] = onFrame[l1];
+        accent[l1 - 1] = accent[l1];
+        vel[l1 - 1] = vel[l1];
+#ifdef CONFIG_CLICK_SYNTH
+        synth[l1 - 1] = synth[l1];
+#endif
+    }
+    nvoices--;
+}
@@ -0,0 +1,100 @@
+/*!
+ * @file clickvoices.h
+ * @brief Defines the ClickVoices pool of overlapping clicks
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef CLICKVOICES_H
+#define CLICKVOICES_H
+
+#include <cstdint>
+#include "config.h"
+#include "clicksynth.h"
+
+/* Clicks sounding at the same time, a click beyond replaces the oldest */
+#define VOICE_MAX       16
+
+/*! @brief Fixed pool of click voices, so that a click does not cut off
+ * the tail of the clicks before it.
+ *
+ * Each voice plays the accented or plain click scaled by its velocity
+ * / 128, and the voices sounding are summed into the output. A voice
+ * ends where the envelope of its click falls below CLICK_CULL_LEVEL,
+ * which is long before the full length of the waves, so that at high
+ * resolutions only a few voices overlap.
+ *
+ * The voices are held as one array per member in the order they
+ * started, the oldest first, and the sum is taken in that order. A
+ * voice is removed once it has ended without reordering the others, so
+ * that the output does not depend on how the frames are split into
+ * render() calls. All state is allocated with the pool.
+ */
+class ClickVoices {
+
+  public:
+    ClickVoices();
+
+#ifdef CONFIG_CLICK_SYNTH
+/*! @brief prepares the synthesizers of the voices for sample_rate */
+    void init(double sample_rate);
+#else
+/*! @brief sets the waves the voices play and their audible lengths.
+ * Voices sounding go on in the new waves.
+ */
+    void setWaves(const float *wave_h, const float *wave_l, uint32_t len_h,
+                    uint32_t len_l);
+#endif
+/*! @brief starts a click at frame
+ *
+ * @param frame Frame of the first sample of the click
+ * @param accent Set to True for the accented click
+ * @param vel Velocity the click is scaled by
+ */
+    void start(uint64_t frame, bool accent, int vel);
+/*! @brief returns True if any voice sounds at frame */
+    bool sounding(uint64_t frame) const { return (frame < endFrame); }
+/*! @brief writes the sum of the voices for nframes from frame to output,
+ * zeros where none sounds */
+    void render(float *output, uint64_t frame, uint32_t nframes);
+/*! @brief moves the voices by delta frames, as the transport does on a
+ * relocation */
+    void shift(int64_t delta);
+    int count() const { return nvoices; }
+
+  private:
+    int nvoices;                    /*!< Voices sounding */
+    uint64_t onFrame[VOICE_MAX];    /*!< Frame at which each voice started */
+    bool accent[VOICE_MAX];
+    int vel[VOICE_MAX];
+    uint64_t endFrame;              /*!< First frame at which no voice sounds */
+#ifdef CONFIG_CLICK_SYNTH
+    ClickSynth synth[VOICE_MAX];
+#else
+    const float *waveH;
+    const float *waveL;
+    uint32_t lenH, lenL;
+#endif
+
+    uint32_t length(int voice) const;
+    void remove(int voice);
+};
+
+#endif
@@ -0,0 +1,93 @@
+/*!
+ * @file clockfollower.cpp
+ * @brief Implements the ClockFollower filter of MIDI clock input timing
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <cmath>
+#include "clockfollower.h"
+
+/* Loop bandwidth after a (re)lock and while tracking, as fraction of the
+ * clock rate */
+#define CLOCKIN_OMEGA_LOCK  0.5
+#define CLOCKIN_OMEGA       0.05
+/* Bandwidth factor per clock from the lock to the tracking bandwidth */
+#define CLOCKIN_NARROW      0.9
+/* Mean prediction error relocking the loop [periods], and the weight of
+ * a clock in the mean */
+#define CLOCKIN_RELOCK      0.1
+#define CLOCKIN_BIAS_WEIGHT 0.25
+/* Gap restarting the phase [periods] */
+#define CLOCKIN_DROPOUT     4
+
+void ClockFollower::reset(double sample_rate)
+{
+    sampleRate = sample_rate;
+    maxPeriod = sample_rate * 60. / (24. * CLOCKIN_MIN_BPM);
+    per = maxPeriod;
+    next = 0;
+    omega = CLOCKIN_OMEGA_LOCK;
+    bias = 0;
+    lastFrame = 0;
+    nclocks = 0;
+}
+
+void ClockFollower::clock(uint64_t frame)
+{
+    const double gap = frame - lastFrame;
+    lastFrame = frame;
+
+    if (!nclocks || ((nclocks == 1) && (gap > maxPeriod))) {
+        /* no usable interval yet */
+        next = frame;
+        nclocks = 1;
+        return;
+    }
+    if (nclocks == 1) {
+        per = (gap < 1) ? 1 : gap;
+        next = frame + per;
+        omega = CLOCKIN_OMEGA_LOCK;
+        nclocks = 2;
+        return;
+    }
+    if (gap > CLOCKIN_DROPOUT * per) {
+        /* the clock resumed after a pause, the tempo is kept */
+        next = frame + per;
+        omega = CLOCKIN_OMEGA_LOCK;
+        bias = 0;
+        return;
+    }
+
+    /* the jitter averages out of the mean error, a tempo change does not */
+    const double err = frame - next;
+    bias += (err - bias) * CLOCKIN_BIAS_WEIGHT;
+    if (fabs(bias) > CLOCKIN_RELOCK * per) {
+        omega = CLOCKIN_OMEGA_LOCK;
+        bias = 0;
+    }
+
+    next += M_SQRT2 * omega * err + per;
+    per += omega * omega * err;
+    if (per < 1) per = 1;
+    if (per > maxPeriod) per = maxPeriod;
+
+    omega *= CLOCKIN_NARROW;
+    if (omega < CLOCKIN_OMEGA) omega = CLOCKIN_OMEGA;
+}
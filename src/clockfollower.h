@@ -0,0 +1,78 @@
+/*!
+ * @file clockfollower.h
+ * @brief Defines the ClockFollower filter of MIDI clock input timing
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef CLOCKFOLLOWER_H
+#define CLOCKFOLLOWER_H
+
+#include <cstdint>
+
+/* Slowest clock input followed [BPM], longer gaps are a dropout */
+#define CLOCKIN_MIN_BPM     20
+
+/*! @brief Tempo and phase of a MIDI clock input, estimated from the frames
+ * the clocks arrive at.
+ *
+ * The filter is a second order delay locked loop: each clock corrects the
+ * predicted frame of the next clock by a part of the prediction error and
+ * the period by a smaller part of it. The loop starts wide to lock within
+ * a few clocks and narrows to its tracking bandwidth, where the jitter of
+ * the clock source is averaged over about a beat. A mean error of more
+ * than a tenth of a period, as from a tempo change, widens it again, a
+ * gap of several periods restarts the phase at the tempo reached.
+ *
+ * Everything is plain arithmetic on members, it runs in the audio thread.
+ */
+class ClockFollower {
+
+  public:
+    ClockFollower() { reset(48000); }
+
+/*! @brief forgets tempo and phase
+ *
+ * @param sample_rate Rate of the frame counts given to clock()
+ */
+    void reset(double sample_rate);
+/*! @brief takes a clock received at frame */
+    void clock(uint64_t frame);
+/*! @brief returns true once two clocks gave a period */
+    bool locked() const { return (nclocks > 1); }
+/*! @brief returns the filtered clock period [frames] */
+    double period() const { return per; }
+/*! @brief returns the predicted frame of the next clock */
+    double nextEdge() const { return next; }
+/*! @brief returns the tempo of the filtered period */
+    double bpm() const { return sampleRate * 60. / (24. * per); }
+
+  private:
+    double sampleRate;
+    double maxPeriod;   /*!< Period of CLOCKIN_MIN_BPM [frames] */
+    double per;
+    double next;
+    double omega;       /*!< Loop bandwidth, normalized to the clock rate */
+    double bias;        /*!< Moving average of the prediction error */
+    uint64_t lastFrame; /*!< Frame of the last clock */
+    int nclocks;        /*!< Clocks since the reset, counted up to 2 */
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*!
+ * @file dspstats.cpp
+ * @brief Implements the DspStats timing figures.
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <cmath>
+#include "dspstats.h"
+
+/* Weight of a new block in the moving average of cycles per block */
+#define DSPSTATS_AVG_WEIGHT (1. / 64.)
+
+DspStats::DspStats()
+{
+    reset(48000);
+}
+
+void DspStats::reset(uint32_t window_frames)
+{
+    cyclesPerBlock = 0;
+    worstBlockUs = 0;
+    queueDepth = 0;
+    clickError = 0;
+    startCycles = 0;
+    startTime.tv_sec = 0;
+    startTime.tv_nsec = 0;
+    avgCycles = 0;
+    window = window_frames ? window_frames : 1;
+    windowPos = 0;
+    worstUs[0] = worstUs[1] = 0;
+    error[0] = error[1] = 0;
+}
+
+void DspStats::endBlock(uint32_t nframes, int queue_depth)
+{
+    struct timespec now;
+    const uint64_t ncycles = cycles() - startCycles;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    const float us = (now.tv_sec - startTime.tv_sec) * 1e6f
+                    + (now.tv_nsec - startTime.tv_nsec) * 1e-3f;
+
+    if (avgCycles == 0) {
+        avgCycles = ncycles;
+    }
+    else {
+        avgCycles += (ncycles - avgCycles) * DSPSTATS_AVG_WEIGHT;
+    }
+    if (us > worstUs[0]) worstUs[0] = us;
+
+    cyclesPerBlock = avgCycles;
+    worstBlockUs = (worstUs[0] > worstUs[1]) ? worstUs[0] : worstUs[1];
+    clickError = (error[0] > error[1]) ? error[0] : error[1];
+    queueDepth = queue_depth;
+
+    /* start a new peak hold window */
+    windowPos += nframes;
+    if (windowPos >= window) {
+        windowPos = 0;
+        worstUs[1] = worstUs[0];
+        error[1] = error[0];
+        worstUs[0] = 0;
+        error[0] = 0;
+    }
+}
+
+void DspStats::clickPlaced(double offset)
+{
+    const float e = fabs(offset);
+    if (e > error[0]) error[0] = e;
+}
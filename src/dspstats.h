@@ -0,0 +1,94 @@
+/*!
+ * @file dspstats.h
+ * @brief Member definitions for the DspStats class.
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DSPSTATS_H
+#define DSPSTATS_H
+
+#include <cstdint>
+#include <ctime>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*! @brief Timing and accuracy figures of the audio callback.
+ *
+ * All members are written by the audio thread only and read by the host
+ * from the control output ports after run() returns, so there is no
+ * locking and nothing is allocated. The block cost is a moving average
+ * over about 64 blocks, the worst block time and the click placement
+ * error are peaks held over a window of about a second.
+ */
+class DspStats {
+
+  public:
+    float cyclesPerBlock;   /*!< Moving average of CPU cycles per block */
+    float worstBlockUs;     /*!< Longest block processing time [us] */
+    float queueDepth;       /*!< Note offs pending at the end of the block */
+    float clickError;       /*!< Largest click offset from the tick grid [frames] */
+
+    DspStats();
+/*! @brief clears all figures and sets the peak hold window */
+    void reset(uint32_t window_frames);
+/*! @brief records the start of a block */
+    void beginBlock()
+    {
+        startCycles = cycles();
+        clock_gettime(CLOCK_MONOTONIC, &startTime);
+    }
+/*! @brief records the end of a block of nframes frames */
+    void endBlock(uint32_t nframes, int queue_depth);
+/*! @brief records a click played offset frames after its exact position
+ * on the tick grid
+ */
+    void clickPlaced(double offset);
+
+/*! @brief returns a cycle count, the virtual counter on ARM and
+ * nanoseconds where no counter is available.
+ */
+    static uint64_t cycles()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t c;
+        __asm__ volatile("mrs %0, cntvct_el0" : "=r"(c));
+        return c;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+    }
+
+  private:
+    uint64_t startCycles;
+    struct timespec startTime;
+    double avgCycles;
+    uint32_t window;        /*!< Peak hold window [frames] */
+    uint32_t windowPos;
+    float worstUs[2];       /*!< Peaks of the current and the last window */
+    float error[2];
+};
+
+#endif
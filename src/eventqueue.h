@@ -0,0 +1,112 @@
+/*!
+ * @file eventqueue.h
+ * @brief Defines the EventQueue template for scheduled MIDI output
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef EVENTQUEUE_H
+#define EVENTQUEUE_H
+
+#include <cstdint>
+
+/*! @brief Fixed capacity queue of events kept sorted by due tick.
+ *
+ * The queue is a ring buffer of SIZE entries, SIZE being a power of two.
+ * It does not allocate, the next due event is read and removed in constant
+ * time. Insertion walks back from the tail, which is constant time for
+ * events scheduled in tick order, as note offs and clocks are. Events due
+ * at the same tick are returned in the order they were pushed.
+ *
+ * When the queue is full, EventQueue::push() refuses the event and returns
+ * false, the caller decides what to drop.
+ */
+template <typename T, int SIZE>
+class EventQueue {
+
+    static_assert(SIZE > 0 && !(SIZE & (SIZE - 1)),
+                    "EventQueue size must be a power of two");
+
+  private:
+    uint64_t ticks[SIZE];
+    T events[SIZE];
+    int head;
+    int count;
+
+  public:
+    EventQueue() : head(0), count(0) {}
+
+    bool empty() const { return !count; }
+    bool full() const { return (count == SIZE); }
+    int size() const { return count; }
+    int capacity() const { return SIZE; }
+    void clear() { head = 0; count = 0; }
+
+/*! @brief returns the tick of the next due event, the queue must not be
+ * empty.
+ */
+    uint64_t nextTick() const { return ticks[head]; }
+/*! @brief returns the next due event, the queue must not be empty. */
+    const T& next() const { return events[head]; }
+/*! @brief removes the next due event, the queue must not be empty. */
+    void pop()
+    {
+        head = (head + 1) & (SIZE - 1);
+        count--;
+    }
+
+/*! @brief moves all queued events by delta ticks, events that would fall
+ * before tick 0 become due at tick 0. The order is kept.
+ */
+    void shift(int64_t delta)
+    {
+        for (int l1 = 0; l1 < count; l1++) {
+            uint64_t& tick = ticks[(head + l1) & (SIZE - 1)];
+            if ((delta < 0) && (tick < (uint64_t)(-delta))) tick = 0;
+            else tick += delta;
+        }
+    }
+
+/*! @brief inserts ev at its tick position
+ *
+ * @param tick Tick at which the event is due
+ * @param ev Event data
+ * @return False if the queue is full and ev was not inserted
+ */
+    bool push(uint64_t tick, const T& ev)
+    {
+        if (count == SIZE) return false;
+
+        int ix = (head + count) & (SIZE - 1);
+        for (int l1 = count; l1 > 0; l1--) {
+            const int prev = (ix - 1) & (SIZE - 1);
+            if (ticks[prev] <= tick) break;
+            ticks[ix] = ticks[prev];
+            events[ix] = events[prev];
+            ix = prev;
+        }
+        ticks[ix] = tick;
+        events[ix] = ev;
+        count++;
+        return true;
+    }
+};
+
+#endif
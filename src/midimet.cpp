@@ -39,8 +39,26 @@ MidiMet::MidiMet()
     midiNoteKey = 57;
     isMuted = false;
     framePtr = 0;
+    nextTick = 0;
+    accent = false;
+    barTick = 0;
+    barTicks = 0;
+
+    anchorFrame = 0;
+    anchorTick = 0;
+    anchorRem = 0;
+    tickStep = 0;
+    tickDiv = 1;
+    rampFrame = 0;
+    rampEndFrame = 0;
+    rampTick = 0;
+    rampPhase = 0;
+    rampRate = 0;
+    rampAccel = 0;
+    rampShape = RAMP_LINEAR;
 
     outFrame.resize(2);
+    pattern = new StepPattern(midiNoteKey);
     
     Sample sample = {0, 0, 0, false};
     sample.data = midiNoteKey;
@@ -55,17 +73,37 @@ MidiMet::MidiMet()
 
 }
 
+MidiMet::~MidiMet()
+{
+    delete pattern;
+}
+
 void MidiMet::getNextFrame(int64_t tick)
 {
     const int frame_nticks = TPQN / res;
+    const Step& step = pattern->steps[framePtr];
     Sample sample = {0, 0, 0, false};
-    if (framePtr == 0) {
-        sample.data = midiNoteKey + 12;
+    if (barTicks) {
+        /* the downbeat from the host barBeat float may be off the grid by
+         * a few ticks, take the click nearest to it */
+        const int64_t half = frame_nticks / 2;
+        if (barTick + half <= tick) {
+            barTick += ((tick - half - barTick) / barTicks + 1) * barTicks;
+        }
+        accent = (barTick < tick + half);
+        if (accent) barTick += barTicks;
+        /* the downbeat replaces the accent on the first step of the
+         * default pattern, programmed accents are kept */
+        if (pattern->programmed) accent |= step.accent;
     }
     else {
-        sample.data = midiNoteKey;
+        accent = step.accent;
     }
-        
+    /* an accent plays the octave above while it is a valid MIDI note */
+    sample.data = (accent && (step.note < 116)) ? step.note + 12 : step.note;
+    sample.value = (step.velocity) ? step.velocity : vel;
+    sample.muted = step.muted;
+
 
     framePtr++;
     framePtr %= nPoints;
@@ -121,6 +159,14 @@ void MidiMet::updateVelocity(int val)
     vel = val;
 }
 
+const StepPattern *MidiMet::swapPattern(const StepPattern *p)
+{
+    const StepPattern *old = pattern;
+
+    pattern = p;
+    return old;
+}
+
 void MidiMet::setFramePtr(int ix)
 {
     framePtr=ix;
@@ -134,6 +180,364 @@ void MidiMet::setNextTick(uint64_t tick)
     nextTick = tick;
 }
 
+/* Unsigned 128 bit integer as two 64 bit halves. Products of frames and
+ * tick rates exceed 64 bits on long runs, these keep them exact on
+ * targets without a native 128 bit type. */
+struct Wide {
+    uint64_t hi, lo;
+};
+
+static Wide mulWide(uint64_t a, uint64_t b)
+{
+    const uint64_t a0 = a & 0xffffffff, a1 = a >> 32;
+    const uint64_t b0 = b & 0xffffffff, b1 = b >> 32;
+    const uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    const uint64_t mid = (p00 >> 32) + (p01 & 0xffffffff) + (p10 & 0xffffffff);
+    Wide w;
+
+    w.lo = (mid << 32) | (p00 & 0xffffffff);
+    w.hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+    return w;
+}
+
+static Wide addWide(Wide a, uint64_t b)
+{
+    a.lo += b;
+    if (a.lo < b) a.hi++;
+    return a;
+}
+
+static Wide subWide(Wide a, uint64_t b)
+{
+    if (a.lo < b) a.hi--;
+    a.lo -= b;
+    return a;
+}
+
+static bool wideAtMost(Wide a, uint64_t b)
+{
+    return (!a.hi && (a.lo <= b));
+}
+
+static int leadingZeros(uint64_t x)
+{
+    int n = 0;
+
+    for (int shift = 32; shift; shift >>= 1) {
+        if (!(x >> (64 - shift))) {
+            n += shift;
+            x <<= shift;
+        }
+    }
+    return n;
+}
+
+/* (u1 * 2^64 + u0) / v for u1 < v, the quotient then fits 64 bits. Long
+ * division in 32 bit digits, after Hacker's Delight, divlu(). */
+static uint64_t divNarrow(uint64_t u1, uint64_t u0, uint64_t v, uint64_t *rem)
+{
+    const uint64_t b = 1ULL << 32;
+    const int s = leadingZeros(v);
+
+    v <<= s;
+    const uint64_t vn1 = v >> 32, vn0 = v & 0xffffffff;
+    const uint64_t un32 = (s) ? (u1 << s) | (u0 >> (64 - s)) : u1;
+    const uint64_t un10 = u0 << s;
+    const uint64_t un1 = un10 >> 32, un0 = un10 & 0xffffffff;
+
+    uint64_t q1 = un32 / vn1;
+    uint64_t rhat = un32 - q1 * vn1;
+    while ((q1 >= b) || (q1 * vn0 > b * rhat + un1)) {
+        q1--;
+        rhat += vn1;
+        if (rhat >= b) break;
+    }
+    /* wraps modulo 2^64, the true value is below v */
+    const uint64_t un21 = un32 * b + un1 - q1 * v;
+
+    uint64_t q0 = un21 / vn1;
+    rhat = un21 - q0 * vn1;
+    while ((q0 >= b) || (q0 * vn0 > b * rhat + un0)) {
+        q0--;
+        rhat += vn1;
+        if (rhat >= b) break;
+    }
+    *rem = (un21 * b + un0 - q0 * v) >> s;
+    return q1 * b + q0;
+}
+
+/* a / d, with the remainder in rem */
+static Wide divWide(Wide a, uint64_t d, uint64_t *rem)
+{
+    Wide q;
+
+    if (!a.hi) {
+        q.hi = 0;
+        q.lo = a.lo / d;
+        *rem = a.lo % d;
+        return q;
+    }
+    q.hi = a.hi / d;
+    q.lo = divNarrow(a.hi % d, a.lo, d, rem);
+    return q;
+}
+
+static uint64_t gcd64(uint64_t a, uint64_t b)
+{
+    while (b) {
+        const uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+void MidiMet::setTickRate(double bpm, double sample_rate)
+{
+    /* A float tempo is exact in units of 2^-24 BPM, host sample rates are
+     * integral. TPQN * bpm / (60 * sample_rate) then stays well inside
+     * 64 bits and frame * tickStep inside 128 bits. */
+    const uint64_t bpm_fixed = (bpm > 0) ? llround(bpm * 16777216.) : 0;
+    const uint64_t rate = (sample_rate >= 1) ? llround(sample_rate) : 1;
+
+    uint64_t step = (uint64_t)TPQN * bpm_fixed;
+    uint64_t div = 60 * rate * 16777216ULL;
+    const uint64_t g = gcd64(step, div);
+    if (g > 1) {
+        step /= g;
+        div /= g;
+    }
+    tickStep = step;
+    tickDiv = div;
+}
+
+void MidiMet::anchorTicks(uint64_t frame, uint64_t tick, uint64_t rem)
+{
+    anchorFrame = frame;
+    anchorTick = tick + rem / tickDiv;
+    anchorRem = rem % tickDiv;
+    rampEndFrame = 0;
+}
+
+void MidiMet::reanchorTicks(uint64_t frame, double bpm, double sample_rate)
+{
+    if (ramping(frame)) {
+        double phase;
+        const uint64_t tick = rampTickAtFrame(frame, &phase);
+        setTickRate(bpm, sample_rate);
+        anchorTicks(frame, tick, (uint64_t)(phase * tickDiv));
+        return;
+    }
+
+    const uint64_t tick = tickAtFrame(frame);
+    uint64_t rem = 0;
+
+    if (frame >= anchorFrame) {
+        divWide(addWide(mulWide(frame - anchorFrame, tickStep), anchorRem),
+                tickDiv, &rem);
+    }
+    const uint64_t old_div = tickDiv;
+    setTickRate(bpm, sample_rate);
+    /* At the same sample rate both denominators divide 60 * rate * 2^24,
+     * so their least common multiple fits and the tick fraction carries
+     * over to it exactly. It is reduced again as far as rem allows. */
+    const uint64_t m = old_div / gcd64(old_div, tickDiv);
+    if ((tickDiv <= UINT64_MAX / m) && (tickStep <= UINT64_MAX / m)) {
+        tickStep *= m;
+        tickDiv *= m;
+    }
+    /* rem is below old_div so the quotient is below tickDiv */
+    uint64_t lost;
+    const uint64_t new_rem = divWide(mulWide(rem, tickDiv), old_div, &lost).lo;
+    const uint64_t g = gcd64(gcd64(tickStep, tickDiv), new_rem);
+    if (g > 1) {
+        tickStep /= g;
+        tickDiv /= g;
+    }
+    anchorTicks(frame, tick, new_rem / g);
+}
+
+void MidiMet::rampTicks(uint64_t frame, double bpm, uint64_t ramp_ticks,
+                    int shape, double sample_rate)
+{
+    const double rate = tickRateAtFrame(frame);
+    double phase = 0;
+    const uint64_t tick = (ramping(frame)) ? rampTickAtFrame(frame, &phase)
+                                           : tickAtFrame(frame);
+    if (!ramping(frame) && (frame >= anchorFrame)) {
+        uint64_t rem;
+        divWide(addWide(mulWide(frame - anchorFrame, tickStep), anchorRem),
+                tickDiv, &rem);
+        phase = (double)rem / tickDiv;
+    }
+
+    setTickRate(bpm, sample_rate);
+    const double end_rate = (double)tickStep / tickDiv;
+    if (!ramp_ticks || (rate <= 0) || (end_rate <= 0) || (rate == end_rate)) {
+        anchorTicks(frame, tick, (uint64_t)(phase * tickDiv));
+        return;
+    }
+
+    /* frames the ramp takes to cover ramp_ticks, and its rate change */
+    const double len = ramp_ticks;
+    double frames, accel;
+    if (shape == RAMP_EXPONENTIAL) {
+        accel = (end_rate - rate) / len;
+        frames = log(end_rate / rate) / accel;
+    }
+    else {
+        frames = 2 * len / (rate + end_rate);
+        accel = (end_rate - rate) / frames;
+    }
+
+    /* the anchor takes over at the first whole frame past the ramp */
+    const uint64_t end = frame + (uint64_t)ceil(frames);
+    const double end_pos = phase + len + ((end - frame) - frames) * end_rate;
+    const double whole = floor(end_pos);
+    anchorTicks(end, tick + (uint64_t)whole,
+                (uint64_t)((end_pos - whole) * tickDiv));
+
+    rampFrame = frame;
+    rampEndFrame = end;
+    rampTick = tick;
+    rampPhase = phase;
+    rampRate = rate;
+    rampAccel = accel;
+    rampShape = shape;
+}
+
+/* Ticks covered by the ramp in its first frames, which may be fractional */
+double MidiMet::rampTicksAt(double frames) const
+{
+    if (frames <= 0) return frames * rampRate;
+    if (rampShape == RAMP_EXPONENTIAL) {
+        return rampRate * expm1(rampAccel * frames) / rampAccel;
+    }
+    return (rampRate + 0.5 * rampAccel * frames) * frames;
+}
+
+/* Frames the ramp takes to cover ticks, the inverse of rampTicksAt() */
+double MidiMet::rampFramesAt(double ticks) const
+{
+    if (ticks <= 0) return ticks / rampRate;
+    if (rampShape == RAMP_EXPONENTIAL) {
+        return log1p(rampAccel * ticks / rampRate) / rampAccel;
+    }
+    /* the root of the quadratic that does not cancel */
+    const double d = rampRate * rampRate + 2 * rampAccel * ticks;
+    return 2 * ticks / (rampRate + sqrt((d > 0) ? d : 0));
+}
+
+uint64_t MidiMet::rampTickAtFrame(uint64_t frame, double *phase) const
+{
+    const double pos = rampPhase + rampTicksAt((double)((int64_t)(frame - rampFrame)));
+    const double whole = floor(pos);
+
+    if ((whole < 0) && (-whole > rampTick)) {
+        *phase = 0;
+        return 0;
+    }
+    *phase = pos - whole;
+    return rampTick + (int64_t)whole;
+}
+
+double MidiMet::tickRateAtFrame(uint64_t frame) const
+{
+    if (!ramping(frame)) return (double)tickStep / tickDiv;
+    if (frame <= rampFrame) return rampRate;
+
+    const double frames = frame - rampFrame;
+    if (rampShape == RAMP_EXPONENTIAL) return rampRate * exp(rampAccel * frames);
+    return rampRate + rampAccel * frames;
+}
+
+uint64_t MidiMet::tickAtFrame(uint64_t frame) const
+{
+    if (ramping(frame)) {
+        double phase;
+        return rampTickAtFrame(frame, &phase);
+    }
+    uint64_t rem;
+    if (frame >= anchorFrame) {
+        const Wide num = addWide(mulWide(frame - anchorFrame, tickStep),
+                                anchorRem);
+        return anchorTick + divWide(num, tickDiv, &rem).lo;
+    }
+    const Wide back = mulWide(anchorFrame - frame, tickStep);
+    if (wideAtMost(back, anchorRem)) return anchorTick;
+    /* ceil((back - anchorRem) / tickDiv) whole ticks before the anchor */
+    Wide nticks = divWide(subWide(back, anchorRem), tickDiv, &rem);
+    if (rem) nticks = addWide(nticks, 1);
+    if (nticks.hi || (nticks.lo >= anchorTick)) return 0;
+    return anchorTick - nticks.lo;
+}
+
+uint64_t MidiMet::frameAtTick(uint64_t tick) const
+{
+    if (!tickStep) return UINT64_MAX;
+
+    if (rampEndFrame && (tick <= tickAtFrame(rampEndFrame - 1))) {
+        /* the closed form may be off by the rounding of the doubles,
+         * which the ticks of the neighbouring frames settle */
+        const double t = rampFramesAt((double)((int64_t)(tick - rampTick))
+                                        - rampPhase);
+        int64_t frame = (int64_t)rampFrame + (int64_t)ceil(t);
+        if (frame < 0) frame = 0;
+        while ((frame > 0) && (tickAtFrame(frame - 1) >= tick)) frame--;
+        while (tickAtFrame(frame) < tick) frame++;
+        return frame;
+    }
+    if (rampEndFrame && (tick <= anchorTick)) {
+        /* reached only at the end of the ramp */
+        return rampEndFrame;
+    }
+
+    if (tick >= anchorTick) {
+        /* smallest n with anchorRem + n * tickStep >= (tick - anchorTick) * tickDiv */
+        const Wide target = mulWide(tick - anchorTick, tickDiv);
+        if (wideAtMost(target, anchorRem)) return anchorFrame;
+        uint64_t rem;
+        Wide n = divWide(subWide(target, anchorRem), tickStep, &rem);
+        if (rem) n = addWide(n, 1);
+        if (n.hi || (n.lo >= UINT64_MAX - anchorFrame)) return UINT64_MAX;
+        return anchorFrame + n.lo;
+    }
+    /* before the anchor: frame anchorFrame - m reaches tick as long as
+     * m * tickStep <= anchorRem + (anchorTick - tick) * tickDiv */
+    uint64_t rem;
+    const Wide m = divWide(addWide(mulWide(anchorTick - tick, tickDiv),
+                                anchorRem), tickStep, &rem);
+    if (m.hi || (m.lo >= anchorFrame)) return 0;
+    return anchorFrame - m.lo;
+}
+
+double MidiMet::framesPastTick(uint64_t frame, uint64_t tick) const
+{
+    if (!tickStep) return 0;
+
+    if (rampEndFrame && (tick <= tickAtFrame(rampEndFrame - 1))) {
+        const double t = rampFramesAt((double)((int64_t)(tick - rampTick))
+                                        - rampPhase);
+        return (double)((int64_t)(frame - rampFrame)) - t;
+    }
+    /* both relative to the anchor, which keeps the doubles small */
+    const double ticks = ((double)((int64_t)(tick - anchorTick)) * tickDiv
+                        - (double)anchorRem) / tickStep;
+    return (double)((int64_t)(frame - anchorFrame)) - ticks;
+}
+
+void MidiMet::setBarPosition(int64_t tick, double bar_beat,
+                            double beats_per_bar)
+{
+    if (beats_per_bar <= 0) {
+        barTicks = 0;
+        return;
+    }
+    barTicks = llround(beats_per_bar * TPQN);
+    /* downbeat of the current bar, getNextFrame() moves on from there */
+    barTick = tick - llround(bar_beat * TPQN);
+}
+
 void MidiMet::setMuted(bool on)
 {
     isMuted = on;
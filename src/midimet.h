@@ -28,10 +28,15 @@
 #include <cstdint>
 #include <vector>
 #include "midievent.h"
+#include "steppattern.h"
 
 #define TPQN           48000
 #define JQ_BUFSZ        1024
 
+/* Shapes of the tempo ramps of MidiMet::rampTicks() */
+#define RAMP_LINEAR         0   /**< tempo changes by a constant amount per frame */
+#define RAMP_EXPONENTIAL    1   /**< tempo changes by a constant ratio per frame */
+
 /*! @brief This array holds the currently available Seq resolution values in beat
  * divisions.
  */
@@ -60,12 +65,31 @@ class MidiMet  {
     int64_t nextTick; /*!< Holds the next tick at which note events will be played out */
     int framePtr;       /*!< position of the currently output frame in sequence */
     int nPoints;        /*!< Number of steps in pattern or sequence */
+    bool accent;        /*!< True if the click in outFrame is accented */
+    int64_t barTick;    /*!< Tick of the next host bar downbeat */
+    int64_t barTicks;   /*!< Host bar length in ticks, 0 without host bar */
+
+    uint64_t anchorFrame;   /*!< Frame at which the tick timebase was anchored */
+    uint64_t anchorTick;    /*!< Whole tick at anchorFrame */
+    uint64_t anchorRem;     /*!< Tick fraction at anchorFrame in units of 1/tickDiv */
+    uint64_t tickStep;      /*!< Ticks per frame are tickStep / tickDiv */
+    uint64_t tickDiv;
+    /* A tempo ramp maps the frames before rampEndFrame in closed form, the
+     * anchor above then holds from rampEndFrame on at the target tempo */
+    uint64_t rampFrame;     /*!< Frame at which the tempo ramp starts */
+    uint64_t rampEndFrame;  /*!< First frame past the ramp, 0 without ramp */
+    uint64_t rampTick;      /*!< Whole tick at rampFrame */
+    double rampPhase;       /*!< Tick fraction at rampFrame */
+    double rampRate;        /*!< Ticks per frame at rampFrame */
+    double rampAccel;       /*!< Rate change per frame, of the log rate for RAMP_EXPONENTIAL */
+    int rampShape;
     
     std::vector<Sample> outFrame;   /*!< Vector of Sample points holding the current frame for transfer */
+    const StepPattern *pattern;     /*!< Settings of each step, owned by MidiMet */
 
   public:
     MidiMet();
-    virtual ~MidiMet() {}
+    virtual ~MidiMet();
     
     void updateVelocity(int);
     void updateResolution(int);
@@ -83,6 +107,64 @@ class MidiMet  {
     virtual void setMuted(bool on);
     
     void setNextTick(uint64_t tick);
+/*! @brief sets the rate of the frame to tick timebase. The rate is held
+ * as an exact fraction of integers, so that ticks computed from frames do
+ * not accumulate rounding errors however long the transport runs.
+ *
+ * @param bpm Tempo in beats per minute
+ * @param sample_rate Frames per second
+ */
+    void setTickRate(double bpm, double sample_rate);
+/*! @brief anchors the timebase so that frame maps to tick plus rem/tickDiv
+ */
+    void anchorTicks(uint64_t frame, uint64_t tick, uint64_t rem = 0);
+/*! @brief changes the timebase rate keeping the tick phase reached at
+ * frame, so that tempo changes do not move the grid. The phase is kept
+ * exactly while the sample rate stays the same.
+ */
+    void reanchorTicks(uint64_t frame, double bpm, double sample_rate);
+/*! @brief changes the timebase rate gradually from its rate at frame to
+ * bpm, keeping the tick phase reached at frame. Ticks and frames of the
+ * ramp map to each other in closed form, at the end of the ramp the
+ * timebase goes on at bpm.
+ *
+ * @param frame Frame at which the ramp starts
+ * @param bpm Tempo at the end of the ramp
+ * @param ramp_ticks Length of the ramp in ticks, 0 changes the rate at
+ * frame as reanchorTicks() does
+ * @param shape RAMP_LINEAR or RAMP_EXPONENTIAL
+ * @param sample_rate Frames per second
+ */
+    void rampTicks(uint64_t frame, double bpm, uint64_t ramp_ticks,
+                    int shape, double sample_rate);
+/*! @brief returns True while frame lies before the end of a tempo ramp */
+    bool ramping(uint64_t frame) const { return (frame < rampEndFrame); }
+/*! @brief returns the rate of the timebase at frame in ticks per frame */
+    double tickRateAtFrame(uint64_t frame) const;
+/*! @brief returns the tick reached at frame. Frames before the anchor are
+ * extrapolated backwards, ticks before zero are returned as zero.
+ */
+    uint64_t tickAtFrame(uint64_t frame) const;
+/*! @brief returns the first frame at which tickAtFrame() reaches tick, or
+ * UINT64_MAX if the timebase is halted.
+ */
+    uint64_t frameAtTick(uint64_t tick) const;
+/*! @brief returns by how many frames, including the fraction, frame lies
+ * after the exact position of tick on the timebase.
+ */
+    double framesPastTick(uint64_t frame, uint64_t tick) const;
+/*! @brief aligns the accents to the host bar instead of the pattern start.
+ * Called on each transport update, so that getNextFrame() only compares
+ * the click tick with the next downbeat.
+ *
+ * @param tick Tick of the transport position
+ * @param bar_beat Beats elapsed in the bar at tick
+ * @param beats_per_bar Bar length in beats, 0 or less returns to accents
+ * at the pattern start
+ */
+    void setBarPosition(int64_t tick, double bar_beat, double beats_per_bar);
+/*! @brief returns the first frame at which MidiMet::nextTick is reached */
+    uint64_t nextTickFrame() const { return frameAtTick(nextTick); }
 /*! @brief  transfers the next Midi data (Sample) to an intermediate internal 
  * (outFrame) MIDI sample vector along with timing. The timing in outFrame 
  * is queried by the driver
@@ -91,8 +173,21 @@ class MidiMet  {
  * used to calculate the nextTick which is quantized to the pattern
  */
     void getNextFrame(int64_t tick);
+/*! @brief replaces the step pattern by one built beforehand. Taking
+ * over a complete table keeps the building off the audio thread.
+ *
+ * @param p Pattern to play from the next click on, MidiMet takes its
+ * ownership
+ * @return The previous pattern, to be deleted by the caller
+ */
+    const StepPattern *swapPattern(const StepPattern *p);
     void setFramePtr(int ix);
     int getFramePtr() { return framePtr; }
+
+  private:
+    double rampTicksAt(double frames) const;
+    double rampFramesAt(double ticks) const;
+    uint64_t rampTickAtFrame(uint64_t frame, double *phase) const;
 };
 
 #endif
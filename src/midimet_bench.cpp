@@ -0,0 +1,628 @@
+/*!
+ * @file midimet_bench.cpp
+ * @brief Offline benchmark of the midimet LV2 plugin run() method
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "offlinehost.h"
+
+#ifndef MIDIMET_PLUGIN_PATH
+#define MIDIMET_PLUGIN_PATH "./midimet.so"
+#endif
+
+#define BENCH_MAX_BLOCK 4096
+
+/* Control port indices */
+#define P_RESOLUTION        5
+#define P_SIZE              6
+#define P_TRANSPORT_MODE    10
+#define P_TEMPO_MODE        11
+#define P_TEMPO             12
+#define P_MIDI_CLOCK        21
+#define P_RAMP_LENGTH       22
+#define P_RAMP_SHAPE        23
+#define P_LAYER_RESOLUTION  24  /* of the first layer, the others follow */
+#define P_LAYER_GAIN        28
+#define LAYER_PORTS         5
+
+/* Transport of the simulated host, shared by all instances */
+struct HostTransport {
+    int64_t pos;
+    float bpm;
+    float speed;
+};
+
+/* MIDI clock input of the slave cases, starting at SLAVE_START. The tempo
+ * alternates between two values every segment clocks, and each clock
+ * arrives up to jitter early or late. */
+struct ClockStream {
+    float bpm[2];
+    uint32_t segment;
+    double jitter;      /**< Largest clock offset [s] */
+};
+
+#define SLAVE_START     0.25    /* First clock [s] */
+#define SLAVE_LOCK      2.0     /* Clicks before this time [s] are not rated */
+#define SLAVE_CLICK     6       /* Clocks per click at the resolution of 4 */
+
+/* A benchmark case sets up the controls once and then changes controls or
+ * host transport before each block. Everything a case does depends only on
+ * the frame count, so that runs are repeatable. */
+struct BenchCase {
+    const char *name;
+    const char *description;
+    void (*setup)(OfflineInstance *inst);
+    void (*block)(OfflineInstance *inst, HostTransport *tr,
+                    uint64_t frame, uint32_t nframes, double sample_rate);
+    const ClockStream *clockIn; /**< MIDI clock input, or NULL */
+};
+
+static void setupFree(OfflineInstance *inst)
+{
+    inst->control[P_TRANSPORT_MODE] = 0;
+    inst->control[P_TEMPO_MODE] = 0;
+    inst->control[P_TEMPO] = 120;
+    inst->control[P_RESOLUTION] = 3;
+}
+
+/* Free running with MIDI clock output, at a tempo with a clock period of
+ * a fractional number of frames */
+static void setupClock(OfflineInstance *inst)
+{
+    setupFree(inst);
+    inst->control[P_TEMPO] = 133.5;
+    inst->control[P_MIDI_CLOCK] = 1;
+}
+
+/* Free running with internal tempo changes ramping over a bar */
+static void setupRamp(OfflineInstance *inst)
+{
+    setupFree(inst);
+    inst->control[P_RAMP_LENGTH] = 1;
+}
+
+/* Free running with the three click layers on, at 3, 5 and 7 clicks
+ * per beat against the main 4 */
+static void setupLayers(OfflineInstance *inst)
+{
+    setupFree(inst);
+    for (int l1 = 0; l1 < 3; l1++) {
+        inst->control[P_LAYER_RESOLUTION + l1 * LAYER_PORTS] = 2 + 2 * l1;
+        inst->control[P_LAYER_GAIN + l1 * LAYER_PORTS] = 0.8;
+    }
+}
+
+/* Following the MIDI clock input */
+static void setupSlave(OfflineInstance *inst)
+{
+    setupFree(inst);
+    inst->control[P_TRANSPORT_MODE] = 2;
+}
+
+static void blockNone(OfflineInstance *, HostTransport *, uint64_t,
+                    uint32_t, double)
+{
+}
+
+/* Internal tempo stepping to a new value every half second */
+static void blockTempo(OfflineInstance *inst, HostTransport *,
+                    uint64_t frame, uint32_t, double sample_rate)
+{
+    const uint64_t step = frame / (uint64_t)(sample_rate / 2);
+    inst->control[P_TEMPO] = 60 + (step * 37) % 181;
+}
+
+/* Internal tempo alternating between 90 and 180 BPM every two seconds,
+ * the ramp shape changing every four seconds */
+static void blockRamp(OfflineInstance *inst, HostTransport *,
+                    uint64_t frame, uint32_t, double sample_rate)
+{
+    const uint64_t step = frame / (uint64_t)(sample_rate * 2);
+    inst->control[P_TEMPO] = (step & 1) ? 180 : 90;
+    inst->control[P_RAMP_SHAPE] = (step / 2) & 1;
+}
+
+/* Resolution changing every quarter second and sequence size every second */
+static void blockResolution(OfflineInstance *inst, HostTransport *,
+                    uint64_t frame, uint32_t, double sample_rate)
+{
+    inst->control[P_RESOLUTION] = (frame / (uint64_t)(sample_rate / 4)) % 13;
+    inst->control[P_SIZE] = (frame / (uint64_t)sample_rate) % 20;
+}
+
+static void setupHost(OfflineInstance *inst)
+{
+    inst->control[P_TRANSPORT_MODE] = 1;
+    inst->control[P_TEMPO_MODE] = 1;
+    inst->control[P_RESOLUTION] = 3;
+}
+
+/* Host transport with a position atom in every block. The transport stops
+ * for half a second every 16 seconds, jumps back by 2 seconds every 8
+ * seconds, and the host tempo changes every 4 seconds. */
+static void blockHost(OfflineInstance *inst, HostTransport *tr,
+                    uint64_t frame, uint32_t, double sample_rate)
+{
+    const float tempos[4] = {120.f, 133.5f, 97.25f, 174.f};
+    const double t = frame / sample_rate;
+
+    tr->speed = (fmod(t, 16.) < 15.5) ? 1 : 0;
+    tr->bpm = tempos[(int)(t / 4.) & 3];
+
+    const double beats = tr->pos / sample_rate * tr->bpm / 60.;
+    inst->beginInput();
+    inst->addPosition(0, tr->pos, tr->bpm, tr->speed, (int64_t)(beats / 4),
+                        fmod(beats, 4.), 4, 4);
+    inst->endInput();
+}
+
+static void advanceHost(HostTransport *tr, uint64_t frame, uint32_t nframes,
+                        double sample_rate)
+{
+    const uint64_t relocate = 8 * (uint64_t)sample_rate;
+
+    if (tr->speed) tr->pos += nframes;
+    if ((frame + nframes) / relocate != frame / relocate) {
+        tr->pos -= std::min<int64_t>(tr->pos, 2 * (int64_t)sample_rate);
+    }
+}
+
+/* Ideal time of clock k of cs [s] */
+static double streamClockTime(const ClockStream& cs, uint64_t k)
+{
+    const double p0 = 60. / (24. * cs.bpm[0]);
+    const double p1 = 60. / (24. * cs.bpm[1]);
+    const uint64_t seg = k / cs.segment;
+    const uint64_t r = k % cs.segment;
+
+    double t = SLAVE_START + (seg / 2) * cs.segment * (p0 + p1);
+    if (seg & 1) t += cs.segment * p0;
+    return t + r * ((seg & 1) ? p1 : p0);
+}
+
+/* Frame clock k of cs arrives at, offset by a repeatable pseudo random
+ * jitter */
+static uint64_t streamClockFrame(const ClockStream& cs, uint64_t k,
+                    double sample_rate)
+{
+    uint32_t h = (uint32_t)k * 2654435761u;
+    h ^= h >> 15;
+    h *= 2246822519u;
+    h ^= h >> 13;
+    const double u = h / 4294967296.;
+    return llround((streamClockTime(cs, k) + cs.jitter * (2 * u - 1))
+                    * sample_rate);
+}
+
+/* Sends Start shortly before the first clock and the clocks arriving in
+ * the block. The jitter is below half a clock period, so the clocks stay
+ * in order. */
+static void feedClock(OfflineInstance *inst, const ClockStream& cs,
+                    uint64_t frame, uint32_t nframes, double sample_rate)
+{
+    const uint64_t end = frame + nframes;
+    const uint64_t start = llround((SLAVE_START - 0.01) * sample_rate);
+    const uint8_t fa = 0xfa, f8 = 0xf8;
+
+    inst->beginInput();
+    if ((start >= frame) && (start < end)) {
+        inst->addMidi(start - frame, &fa, 1);
+    }
+
+    /* first clock that may arrive from frame on, with a frame of margin
+     * for the rounding */
+    const double first = frame - 1;
+    uint64_t lo = 0, hi = 1;
+    while ((streamClockTime(cs, hi) + cs.jitter) * sample_rate < first) hi *= 2;
+    while (lo < hi) {
+        const uint64_t mid = (lo + hi) / 2;
+        if ((streamClockTime(cs, mid) + cs.jitter) * sample_rate < first) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    for (uint64_t k = lo;
+            (streamClockTime(cs, k) - cs.jitter) * sample_rate < end + 1; k++) {
+        const uint64_t f = streamClockFrame(cs, k, sample_rate);
+        if ((f >= frame) && (f < end)) inst->addMidi(f - frame, &f8, 1);
+    }
+    inst->endInput();
+}
+
+static const ClockStream steadyClock = {{120.f, 120.f}, 384, 1e-3};
+static const ClockStream jitterClock = {{120.f, 120.f}, 384, 3e-3};
+static const ClockStream tempoClock = {{120.f, 133.5f}, 192, 1e-3};
+
+static const BenchCase benchCases[] = {
+    {"free", "free running at constant tempo", setupFree, blockNone, NULL},
+    {"tempo", "free running, internal tempo change every 0.5 s",
+        setupFree, blockTempo, NULL},
+    {"ramp", "free running, internal tempo ramps over a bar between 90 "
+        "and 180 BPM every 2 s", setupRamp, blockRamp, NULL},
+    {"layers", "free running, three click layers at 3, 5 and 7 against 4",
+        setupLayers, blockNone, NULL},
+    {"resolution", "free running, resolution change every 0.25 s",
+        setupFree, blockResolution, NULL},
+    {"host", "host transport atoms every block, tempo changes, "
+        "stops and relocations", setupHost, blockHost, NULL},
+    {"clock", "free running at constant tempo with MIDI clock output",
+        setupClock, blockNone, NULL},
+    {"slave", "MIDI clock input at 120 BPM with 1 ms jitter",
+        setupSlave, blockNone, &steadyClock},
+    {"slave-jitter", "MIDI clock input at 120 BPM with 3 ms jitter",
+        setupSlave, blockNone, &jitterClock},
+    {"slave-tempo", "MIDI clock input alternating 120 and 133.5 BPM every "
+        "2 bars, 1 ms jitter", setupSlave, blockNone, &tempoClock},
+};
+
+static const int nBenchCases = sizeof(benchCases) / sizeof(benchCases[0]);
+
+struct BenchResult {
+    uint64_t frames;
+    double totalNs;
+    double p50Ns;
+    double p99Ns;
+    double maxNs;
+    uint64_t clocks;        /**< MIDI clocks sent by the first instance */
+    double clockJitterPp;   /**< Peak to peak clock jitter [us] */
+    double clockJitterRms;  /**< RMS clock jitter [us] */
+    double trackErrRms;     /**< RMS click offset from the clock input [us] */
+    double trackErrMax;     /**< Largest click offset from the clock input [us] */
+};
+
+/* Adds the frames of the note ons in the output of inst to notes */
+static void collectNotes(const OfflineInstance *inst, uint64_t frame,
+                    std::vector<uint64_t> *notes)
+{
+    LV2_ATOM_SEQUENCE_FOREACH(inst->midiOut(), ev) {
+        const uint8_t *msg = (const uint8_t *)LV2_ATOM_BODY_CONST(&ev->body);
+        if ((ev->body.size == 3) && ((msg[0] & 0xf0) == 0x90) && msg[2]) {
+            notes->push_back(frame + ev->time.frames);
+        }
+    }
+}
+
+/* Sets the tracking error of a slave case as the offset of each click
+ * from the ideal time of its clock, without the jitter, once the clock
+ * follower had time to lock. A missed or doubled click shifts all later
+ * ones by a click and shows as a large error. */
+static void trackingError(const std::vector<uint64_t>& notes,
+                    const ClockStream& cs, double sample_rate,
+                    BenchResult *result)
+{
+    double sq = 0, peak = 0;
+    size_t n = 0;
+
+    for (size_t j = 0; j < notes.size(); j++) {
+        const double t = streamClockTime(cs, j * SLAVE_CLICK);
+        if (t < SLAVE_LOCK) continue;
+        const double err = notes[j] / sample_rate - t;
+        sq += err * err;
+        peak = std::max(peak, fabs(err));
+        n++;
+    }
+    result->trackErrRms = n ? sqrt(sq / n) * 1e6 : 0;
+    result->trackErrMax = peak * 1e6;
+}
+
+/* Adds the frames of the MIDI clocks in the output of inst to clocks */
+static void collectClocks(const OfflineInstance *inst, uint64_t frame,
+                    std::vector<uint64_t> *clocks)
+{
+    LV2_ATOM_SEQUENCE_FOREACH(inst->midiOut(), ev) {
+        const uint8_t *msg = (const uint8_t *)LV2_ATOM_BODY_CONST(&ev->body);
+        if ((ev->body.size == 1) && (msg[0] == 0xf8)) {
+            clocks->push_back(frame + ev->time.frames);
+        }
+    }
+}
+
+/* Sets the jitter of the clock frames in result as their deviation from
+ * the least squares line through them, which at constant tempo is the
+ * ideal clock. A sample accurate clock stays within one frame. */
+static void clockJitter(const std::vector<uint64_t>& clocks,
+                    double sample_rate, BenchResult *result)
+{
+    const size_t n = clocks.size();
+
+    result->clocks = n;
+    result->clockJitterPp = 0;
+    result->clockJitterRms = 0;
+    if (n < 3) return;
+
+    /* centered on the first clock to keep the sums exact enough */
+    double sk = 0, sx = 0, skk = 0, skx = 0;
+    for (size_t k = 0; k < n; k++) {
+        const double x = clocks[k] - clocks[0];
+        sk += k;
+        sx += x;
+        skk += (double)k * k;
+        skx += k * x;
+    }
+    const double period = (n * skx - sk * sx) / (n * skk - sk * sk);
+    const double offset = (sx - period * sk) / n;
+
+    double lo = 0, hi = 0, sq = 0;
+    for (size_t k = 0; k < n; k++) {
+        const double err = (double)(clocks[k] - clocks[0]) - offset - period * k;
+        lo = std::min(lo, err);
+        hi = std::max(hi, err);
+        sq += err * err;
+    }
+    result->clockJitterPp = (hi - lo) / sample_rate * 1e6;
+    result->clockJitterRms = sqrt(sq / n) / sample_rate * 1e6;
+}
+
+static double percentile(std::vector<double>& v, double p)
+{
+    if (v.empty()) return 0;
+
+    size_t ix = (size_t)ceil(p * v.size());
+    if (ix) ix--;
+    std::nth_element(v.begin(), v.begin() + ix, v.end());
+    return v[ix];
+}
+
+/* Runs one case. Each block is prepared for all instances first, then the
+ * run() calls of all instances are timed together as the block time. */
+static bool runCase(OfflineHost *host, const BenchCase& bc, double sample_rate,
+                    uint32_t block_size, int instances, double seconds,
+                    BenchResult *result)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    std::vector<OfflineInstance *> inst;
+    bool ok = true;
+    for (int l1 = 0; l1 < instances; l1++) {
+        inst.push_back(new OfflineInstance(host, sample_rate, block_size));
+        if (!inst.back()->valid()) ok = false;
+    }
+
+    if (ok) {
+        const uint64_t warmup = (uint64_t)(sample_rate / 2);
+        const uint64_t nframes = (uint64_t)(seconds * sample_rate);
+        const uint64_t nblocks = (nframes + block_size - 1) / block_size;
+        std::vector<double> blockNs;
+        std::vector<uint64_t> clocks, notes;
+        HostTransport tr = {0, 120.f, 0.f};
+
+        blockNs.reserve(nblocks);
+        for (int l1 = 0; l1 < instances; l1++) {
+            bc.setup(inst[l1]);
+            inst[l1]->activate();
+        }
+
+        double totalNs = 0;
+        uint64_t frame = 0;
+        while (frame < warmup + nframes) {
+            const uint32_t n = block_size;
+            for (int l1 = 0; l1 < instances; l1++) {
+                if (bc.clockIn) {
+                    feedClock(inst[l1], *bc.clockIn, frame, n, sample_rate);
+                }
+                bc.block(inst[l1], &tr, frame, n, sample_rate);
+            }
+
+            const Clock::time_point t0 = Clock::now();
+            for (int l1 = 0; l1 < instances; l1++) {
+                inst[l1]->run(n);
+            }
+            const Clock::time_point t1 = Clock::now();
+
+            /* clicks are counted from the start of the clock input */
+            if (bc.clockIn) collectNotes(inst[0], frame, &notes);
+            if (frame >= warmup) {
+                const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+                blockNs.push_back(ns);
+                totalNs += ns;
+                collectClocks(inst[0], frame, &clocks);
+            }
+            advanceHost(&tr, frame, n, sample_rate);
+            frame += n;
+        }
+
+        result->frames = frame - warmup;
+        result->totalNs = totalNs;
+        result->maxNs = *std::max_element(blockNs.begin(), blockNs.end());
+        result->p99Ns = percentile(blockNs, 0.99);
+        result->p50Ns = percentile(blockNs, 0.5);
+        clockJitter(clocks, sample_rate, result);
+        result->trackErrRms = 0;
+        result->trackErrMax = 0;
+        if (bc.clockIn) {
+            trackingError(notes, *bc.clockIn, sample_rate, result);
+        }
+    }
+
+    for (int l1 = 0; l1 < instances; l1++) delete inst[l1];
+    return ok;
+}
+
+static bool parseList(const char *arg, std::vector<double> *list)
+{
+    list->clear();
+    const char *p = arg;
+    while (*p) {
+        char *end;
+        const double v = strtod(p, &end);
+        if (end == p || v <= 0) return false;
+        list->push_back(v);
+        p = end;
+        if (*p == ',') p++;
+        else if (*p) return false;
+    }
+    return !list->empty();
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -p PATH   plugin module (default %s)\n"
+        "  -c LIST   cases, comma separated (default all)\n"
+        "  -b LIST   block sizes 1-%d (default 1,16,64,256,1024,4096)\n"
+        "  -r LIST   sample rates (default 48000)\n"
+        "  -n LIST   instance counts (default 1)\n"
+        "  -s SEC    seconds of output per measurement (default 20)\n"
+        "  -l        list the cases\n"
+        "Results are written to stdout as CSV, one line per measurement.\n",
+        name, MIDIMET_PLUGIN_PATH, BENCH_MAX_BLOCK);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = MIDIMET_PLUGIN_PATH;
+    std::vector<double> blockSizes, sampleRates, instanceCounts;
+    std::vector<const BenchCase *> cases;
+    double seconds = 20;
+    int opt;
+
+    parseList("1,16,64,256,1024,4096", &blockSizes);
+    parseList("48000", &sampleRates);
+    parseList("1", &instanceCounts);
+
+    while ((opt = getopt(argc, argv, "p:c:b:r:n:s:lh")) != -1) {
+        switch (opt) {
+        case 'p':
+            path = optarg;
+            break;
+        case 'c': {
+            std::string list = optarg;
+            size_t start = 0;
+            while (start <= list.size()) {
+                size_t end = list.find(',', start);
+                if (end == std::string::npos) end = list.size();
+                const std::string name = list.substr(start, end - start);
+                int l1 = 0;
+                while (l1 < nBenchCases && name != benchCases[l1].name) l1++;
+                if (l1 == nBenchCases) {
+                    fprintf(stderr, "unknown case: %s\n", name.c_str());
+                    return 1;
+                }
+                cases.push_back(&benchCases[l1]);
+                start = end + 1;
+            }
+            break;
+        }
+        case 'b':
+            if (!parseList(optarg, &blockSizes)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            if (!parseList(optarg, &sampleRates)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'n':
+            if (!parseList(optarg, &instanceCounts)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            seconds = atof(optarg);
+            if (seconds <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'l':
+            for (int l1 = 0; l1 < nBenchCases; l1++) {
+                printf("%-12s %s\n", benchCases[l1].name,
+                        benchCases[l1].description);
+            }
+            return 0;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (cases.empty()) {
+        for (int l1 = 0; l1 < nBenchCases; l1++) cases.push_back(&benchCases[l1]);
+    }
+    for (size_t l1 = 0; l1 < blockSizes.size(); l1++) {
+        if (blockSizes[l1] > BENCH_MAX_BLOCK) {
+            fprintf(stderr, "block size %g exceeds %d\n", blockSizes[l1],
+                    BENCH_MAX_BLOCK);
+            return 1;
+        }
+    }
+
+    OfflineHost host;
+    if (!host.load(path)) {
+        fprintf(stderr, "%s\n", host.error().c_str());
+        return 1;
+    }
+
+    printf("case,sample_rate,block_size,instances,frames,ns_per_frame,"
+            "block_p50_ns,block_p99_ns,block_max_ns,frames_per_sec,"
+            "realtime_factor,clocks,clock_jitter_pp_us,clock_jitter_rms_us,"
+            "track_err_rms_us,track_err_max_us\n");
+
+    for (size_t c = 0; c < cases.size(); c++) {
+        for (size_t r = 0; r < sampleRates.size(); r++) {
+            for (size_t b = 0; b < blockSizes.size(); b++) {
+                for (size_t n = 0; n < instanceCounts.size(); n++) {
+                    const double sr = sampleRates[r];
+                    const uint32_t bs = (uint32_t)blockSizes[b];
+                    const int ni = (int)instanceCounts[n];
+                    BenchResult res;
+
+                    if (!runCase(&host, *cases[c], sr, bs, ni, seconds, &res)) {
+                        fprintf(stderr, "instantiation failed\n");
+                        return 1;
+                    }
+
+                    /* frame counts are per instance, rates across all */
+                    const double sec = res.totalNs * 1e-9;
+                    printf("%s,%g,%u,%d,%llu,%.3f,%.0f,%.0f,%.0f,%.0f,%.1f,"
+                        "%llu,%.2f,%.2f,%.2f,%.2f\n",
+                        cases[c]->name, sr, bs, ni,
+                        (unsigned long long)res.frames,
+                        res.totalNs / ((double)res.frames * ni),
+                        res.p50Ns, res.p99Ns, res.maxNs,
+                        (double)res.frames * ni / sec,
+                        res.frames / sr / sec,
+                        (unsigned long long)res.clocks,
+                        res.clockJitterPp, res.clockJitterRms,
+                        res.trackErrRms, res.trackErrMax);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
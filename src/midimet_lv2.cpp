@@ -23,90 +23,202 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
 #include <cmath>
 #include "midimet_lv2.h"
+#include "audiokernel.h"
+
+/* Port indices of the MIDI-only and audio-only variants mapped to those of
+ * the full plugin. The audio-only variant has no note length and output
+ * channel controls, nor note and output channel controls of the layers. */
+static const uint8_t midiPortMap[38] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                                        17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28,
+                                        29, 30, 31, 32, 33, 34, 35, 36, 37, 38};
+static const uint8_t audioPortMap[29] = {0, 2, 3, 5, 6, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                                        17, 18, 19, 20, 22, 23, 24, 25, 28, 29, 30, 33,
+                                        34, 35, 38};
+
+/* Control input fields in the order updateParams() applies them */
+static const int inputFields[] = {
+    MidiMetLV2::VELOCITY, MidiMetLV2::NOTELENGTH, MidiMetLV2::TIMESHIFT,
+    MidiMetLV2::RESOLUTION, MidiMetLV2::SIZE, MidiMetLV2::MUTE,
+    MidiMetLV2::CH_OUT, MidiMetLV2::RAMP_LENGTH, MidiMetLV2::RAMP_SHAPE,
+    MidiMetLV2::TEMPO, MidiMetLV2::TEMPO_MODE, MidiMetLV2::TRANSPORT_MODE,
+    MidiMetLV2::MIDI_CLOCK,
+    /* fields of the three layers, the resolution goes first, so that a
+     * layer turned on starts on its grid */
+    MidiMetLV2::LAYER_RESOLUTION,
+    MidiMetLV2::LAYER_SIZE,
+    MidiMetLV2::LAYER_NOTE,
+    MidiMetLV2::LAYER_CH_OUT,
+    MidiMetLV2::LAYER_GAIN,
+    MidiMetLV2::LAYER_RESOLUTION + LAYER_FIELDS,
+    MidiMetLV2::LAYER_SIZE + LAYER_FIELDS,
+    MidiMetLV2::LAYER_NOTE + LAYER_FIELDS,
+    MidiMetLV2::LAYER_CH_OUT + LAYER_FIELDS,
+    MidiMetLV2::LAYER_GAIN + LAYER_FIELDS,
+    MidiMetLV2::LAYER_RESOLUTION + 2 * LAYER_FIELDS,
+    MidiMetLV2::LAYER_SIZE + 2 * LAYER_FIELDS,
+    MidiMetLV2::LAYER_NOTE + 2 * LAYER_FIELDS,
+    MidiMetLV2::LAYER_CH_OUT + 2 * LAYER_FIELDS,
+    MidiMetLV2::LAYER_GAIN + 2 * LAYER_FIELDS
+};
+
+/* Parameters of the patch:Set input, with the field of the control port
+ * they stand for and its range */
+static const struct {
+    const char *uri;
+    int field;
+    float min;
+    float max;
+} patchParams[] = {
+    {MIDIMET_LV2_PREFIX "velocity", MidiMetLV2::VELOCITY, 0, 127},
+    {MIDIMET_LV2_PREFIX "noteLength", MidiMetLV2::NOTELENGTH, 0, 127},
+    {MIDIMET_LV2_PREFIX "resolution", MidiMetLV2::RESOLUTION, 0, 12},
+    {MIDIMET_LV2_PREFIX "size", MidiMetLV2::SIZE, 0, 19},
+    {MIDIMET_LV2_PREFIX "mute", MidiMetLV2::MUTE, 0, 1},
+    {MIDIMET_LV2_PREFIX "tempo", MidiMetLV2::TEMPO, 10, 400},
+    {MIDIMET_LV2_PREFIX "timeshift", MidiMetLV2::TIMESHIFT, -100, 100},
+};
+
+/* Only the audio thread fills the retire slots, a slot it finds free
+ * stays free until it fills it */
+template <typename T>
+static bool hasFreeSlot(const std::atomic<const T *> *slots)
+{
+    for (int l1 = 0; l1 < RETIRE_SLOTS; l1++) {
+        if (!slots[l1].load()) return true;
+    }
+    return false;
+}
+
+template <typename T>
+static bool keepRetired(std::atomic<const T *> *slots, const T *p)
+{
+    for (int l1 = 0; l1 < RETIRE_SLOTS; l1++) {
+        const T *expected = NULL;
+        if (slots[l1].compare_exchange_strong(expected, p)) return true;
+    }
+    return false;
+}
+
+/* Called outside the audio thread, possibly by several threads at once */
+template <typename T>
+static void deleteRetired(std::atomic<const T *> *slots)
+{
+    for (int l1 = 0; l1 < RETIRE_SLOTS; l1++) delete slots[l1].exchange(NULL);
+}
 
 MidiMetLV2::MidiMetLV2 (
-    double sample_rate, const LV2_Feature *const *host_features )
+    double sample_rate, const LV2_Feature *const *host_features, int outputs )
     :MidiMet()
 {
-    for (int l1 = 0; l1 < 17; l1++) val[l1] = 0;
+    /* control values used for ports a variant does not have */
+    const float defaults[14] = {64, 60, 0, 3, 0, 0, 0, 0, 1, 120, 120, 0, 0, 0};
+    for (int l1 = 0; l1 < 14; l1++) {
+        unconnected[l1] = defaults[l1];
+        val[l1] = &unconnected[l1];
+    }
+    for (int l1 = 14; l1 < 18; l1++) val[l1] = 0;
+    for (int l1 = MIDI_CLOCK; l1 <= RAMP_SHAPE; l1++) {
+        unconnected[l1] = 0;
+        val[l1] = &unconnected[l1];
+    }
+    /* layers are off, at a resolution of 3 and a length of 4 */
+    for (int l1 = 0; l1 < LAYER_MAX; l1++) {
+        const int field = LAYER_RESOLUTION + l1 * LAYER_FIELDS;
+        const float layer_defaults[LAYER_FIELDS] = {2, 3, 60.f + 2 * l1, 0, 0};
+        for (int l2 = 0; l2 < LAYER_FIELDS; l2++) {
+            unconnected[field + l2] = layer_defaults[l2];
+            val[field + l2] = &unconnected[field + l2];
+        }
+    }
+    instrumented = false;
+    /* all ports are applied with the first block */
+    for (int l1 = 0; l1 < 36; l1++) {
+        portValue[l1] = NAN;
+        paramKey[l1] = 0;
+    }
+
+    if (outputs == MIDIMET_OUT_MIDI) {
+        portMap = midiPortMap;
+    }
+    else if (outputs == MIDIMET_OUT_AUDIO) {
+        portMap = audioPortMap;
+    }
+    else {
+        portMap = NULL;
+    }
+    outputPort = NULL;
 
     sampleRate = sample_rate;
     curFrame = 0;
-    soundOnFrame = 0;
     inEventBuffer = NULL;
     outEventBuffer = NULL;
     tempo = 120.0f;
     internalTempo = 120.0f;
+    rampBars = 0;
+    rampShape = RAMP_LINEAR;
 
     transportBpm = 120.0f;
     transportFramesDelta = 0;
     curTick = 0;
-    
-    tempoChangeTick = 0;
+    setTickRate(tempo, sampleRate);
+
     hostTransport = false;
+    tempoFromHost = false;
+    hostRamp = false;
     transportSpeed = 1;
     transportAtomReceived = false;
-    
-    for (int l1 = 0; l1 < JQ_BUFSZ; l1++) {
-        evQueue[l1] = 0;
-        evTickQueue[l1] = 0;
-    }
 
+    clockIn.reset(sampleRate);
+    clockSlave = false;
+    slaveStarting = false;
+    slaveClock = 0;
 
-    bufPtr = 0;
-    elapsed_len = 0;
 
-    LV2_URID_Map *urid_map;
+    clockOut = false;
+    clockRunning = false;
+    clockPending = EV_NONE;
+    nextClockTick = 0;
 
-    //Generate "FM" wave
-    const float amp = .5;
-    
-    // Carrier (position 0) and Modulator Oscillator parameters
-    const float FH[5] = {880,       1.5,    4,    8,    12}; // Hz
-    const float FL[5] = {440,       1.5,    4,    8,    12}; // Hz
-    const int   A[5] =  {1,   12,      8,    8,    10};
-    // const int   A[5] =  {1,   8,      8,    5,    10};
-    // const int   A[5] =  {1,   0,      0,    0,    0};
-    const float T[5] =  {.02,     .015,   .01,  .01,  .005}; // seconds
-    
-    // We are cutting of the wave when time is beyond 30 decay times
-    const uint32_t npoints = (int)(30 * T[0] * sampleRate);
-        
-    wave_len = npoints;
-    
-    clock_fm          = (float*)malloc(npoints * sizeof(float));
-    wave_h            = (float*)malloc(npoints * sizeof(float));
-    wave_l            = (float*)malloc(npoints * sizeof(float));
-
-    for (uint32_t clock = 0; clock < npoints; clock++) {
-        clock_fm[clock] = clock;
+    referenceRun = (getenv("MIDIMET_REFERENCE_RUN") != NULL);
+    restoredPattern = NULL;
+    for (int l1 = 0; l1 < RETIRE_SLOTS; l1++) {
+        retiredPatterns[l1] = NULL;
+        droppedPatterns[l1] = NULL;
     }
-    for (uint32_t i = 1; i < 5; i++) {
-        for (uint32_t clock = 0; clock < npoints; clock++) {
-            clock_fm[clock] += (sin((FH[i] * M_PI * FH[0] / sampleRate) * clock) * A[i]) *
-                                exp(-1.* clock / npoints /T[i]);
-        }
+
+    LV2_URID_Map *urid_map;
+
+#ifdef CONFIG_CLICK_SYNTH
+    if (outputs & MIDIMET_OUT_AUDIO) voices.init(sampleRate);
+#else
+    clickTable = NULL;
+    if (outputs & MIDIMET_OUT_AUDIO) {
+        clickTable = ClickTable::acquire(sampleRate);
+        voices.setWaves(clickTable->waveH, clickTable->waveL,
+                        clickTable->audibleH, clickTable->audibleL);
     }
-    
-    for (uint32_t clock = 0; clock < npoints; clock++) {
-        wave_h[clock] = (sin((2 * M_PI * FH[0] / sampleRate) * clock_fm[clock]) * A[0])
-                        * exp(-1. * clock / npoints /T[0])
-                        * amp;
-        wave_l[clock] = (sin((2 * M_PI * FL[0] / sampleRate) * clock_fm[clock]) * A[0])
-                        * exp(-1. * clock / npoints /T[0])
-                        * amp * 2;
+    clickSamples = NULL;
+    restoredSamples = NULL;
+    for (int l1 = 0; l1 < RETIRE_SLOTS; l1++) {
+        retiredSamples[l1] = NULL;
+        droppedSamples[l1] = NULL;
     }
-
+#endif
 
     /* Scan host features for URID map */
     urid_map = NULL;
+    schedule = NULL;
     
     for (int i = 0; host_features[i]; ++i) {
         if (::strcmp(host_features[i]->URI, LV2_URID_URI "#map") == 0) {
             urid_map = (LV2_URID_Map *) host_features[i]->data;
             }
+        else if (::strcmp(host_features[i]->URI, LV2_WORKER__schedule) == 0) {
+            schedule = (LV2_Worker_Schedule *) host_features[i]->data;
+        }
     }
     if (!urid_map) {
         printf("Host does not support urid:map.\n");
@@ -119,15 +231,31 @@ MidiMetLV2::MidiMetLV2 (
     MidiMetURIs* const uris = &m_uris;
     map_uris(urid_map, uris);
     uridMap = urid_map;
+    for (size_t l1 = 0; l1 < sizeof(patchParams) / sizeof(patchParams[0]); l1++) {
+        paramKey[patchParams[l1].field] =
+                urid_map->map(urid_map->handle, patchParams[l1].uri);
+    }
 }
 
 
 MidiMetLV2::~MidiMetLV2 (void)
 {
+    delete restoredPattern.load();
+    deleteRetired(retiredPatterns);
+    deleteRetired(droppedPatterns);
+#ifndef CONFIG_CLICK_SYNTH
+    delete clickSamples;
+    delete restoredSamples.load();
+    deleteRetired(retiredSamples);
+    deleteRetired(droppedSamples);
+    ClickTable::release(clickTable);
+#endif
 }
 
 void MidiMetLV2::connect_port ( uint32_t port, void *seqdata )
 {
+    if (portMap) port = portMap[port];
+
     switch(port) {
     case 0:
         outputPort = (float*)seqdata;
@@ -140,6 +268,8 @@ void MidiMetLV2::connect_port ( uint32_t port, void *seqdata )
         break;
     default:
         val[port - 3] = (float *)seqdata;
+        instrumented = (val[DSP_CYCLES] || val[DSP_WORST]
+                        || val[NOTEOFF_QUEUE] || val[CLICK_ERROR]);
         break;
     }
 }
@@ -157,17 +287,468 @@ void MidiMetLV2::updatePosAtom(const LV2_Atom_Object* obj)
     transportAtomReceived = true;
 
     LV2_Atom *bpm = NULL, *speed = NULL, *pos = NULL;
+    LV2_Atom *bar_beat = NULL, *beats_per_bar = NULL;
     lv2_atom_object_get(obj,
                         uris->time_frame, &pos,
                         uris->time_beatsPerMinute, &bpm,
                         uris->time_speed, &speed,
+                        uris->time_barBeat, &bar_beat,
+                        uris->time_beatsPerBar, &beats_per_bar,
                         NULL);
 
     if (bpm && bpm->type == uris->atom_Float) bpm1 = ((LV2_Atom_Float*)bpm)->body;
     if (pos && pos->type == uris->atom_Long)  pos1 = ((LV2_Atom_Long*)pos)->body;
     if (speed && speed->type == uris->atom_Float) speed1 = ((LV2_Atom_Float*)speed)->body;
 
+    const bool tempo_change = hostTransport && transportSpeed && speed1
+                        && (curFrame == pos1) && (tempo != bpm1);
+    /* while the tempo changes from atom to atom the correction is held
+     * to what a ramp can account for, so that a host sending erratic
+     * beat positions cannot move the ticks back and forth */
+    const int64_t max_delta = (hostRamp) ? RAMP_MAX_CORRECTION : TPQN / 2;
+    hostRamp = tempo_change;
     updatePos(pos1, bpm1, speed1);
+
+    /* The tempo of an atom holds for its block only, while a ramping host
+     * integrates the tempo within the block. The ticks go on from their
+     * phase at a tempo change and take over the beat phase of the host,
+     * so that the clicks stay on the host beats. */
+    if (tempo_change && bar_beat && (bar_beat->type == uris->atom_Float)) {
+        const double beat = ((LV2_Atom_Float*)bar_beat)->body;
+        const int64_t tick = tickAtFrame(curFrame);
+        int64_t delta = llround((beat - floor(beat)) * TPQN) - tick % TPQN;
+        if (delta > TPQN / 2) delta -= TPQN;
+        if (delta < -TPQN / 2) delta += TPQN;
+        if (delta && (llabs(delta) <= max_delta) && (tick + delta >= 0)) {
+            noteOffQueue.shift(delta);
+            anchorTicks(curFrame, tick + delta);
+        }
+    }
+
+    /* The atom frame is exact, so a jump while rolling is a host locate */
+    if (pos && hostTransport && transportSpeed && (curFrame != pos1)) {
+        relocate(pos1);
+    }
+
+    if (hostTransport && bar_beat && (bar_beat->type == uris->atom_Float)
+            && beats_per_bar && (beats_per_bar->type == uris->atom_Float)) {
+        setBarPosition(tickAtFrame((pos) ? pos1 : curFrame),
+                        ((LV2_Atom_Float*)bar_beat)->body,
+                        ((LV2_Atom_Float*)beats_per_bar)->body);
+    }
+}
+
+void MidiMetLV2::updatePatchAtom(const LV2_Atom_Object* obj)
+{
+    MidiMetURIs* const uris = &m_uris;
+
+    const LV2_Atom *property = NULL, *value = NULL;
+    lv2_atom_object_get(obj, uris->patch_property, &property,
+                        uris->patch_value, &value, NULL);
+
+    if (!property || (property->type != uris->atom_URID)) return;
+
+    const LV2_URID key = ((const LV2_Atom_URID*)property)->body;
+
+    /* parameters take effect right away, at the frame of the message */
+    for (size_t l1 = 0; l1 < sizeof(patchParams) / sizeof(patchParams[0]); l1++) {
+        if (paramKey[patchParams[l1].field] != key) continue;
+        if (!value) return;
+
+        float v;
+        if (value->type == uris->atom_Float) {
+            v = ((const LV2_Atom_Float*)value)->body;
+        }
+        else if (value->type == uris->atom_Double) {
+            v = ((const LV2_Atom_Double*)value)->body;
+        }
+        else if (value->type == uris->atom_Int) {
+            v = ((const LV2_Atom_Int*)value)->body;
+        }
+        else if (value->type == uris->atom_Long) {
+            v = ((const LV2_Atom_Long*)value)->body;
+        }
+        else {
+            return;
+        }
+        if (!(v >= patchParams[l1].min)) v = patchParams[l1].min;
+        if (v > patchParams[l1].max) v = patchParams[l1].max;
+        applyParam(patchParams[l1].field, v);
+        return;
+    }
+
+    if ((key != uris->pattern) && (key != uris->click)
+            && (key != uris->accentClick)) {
+        return;
+    }
+
+    /* patterns and samples are built by the worker, see work() */
+    if (schedule) {
+        schedule->schedule_work(schedule->handle,
+                                lv2_atom_total_size(&obj->atom), obj);
+    }
+}
+
+LV2_Worker_Status MidiMetLV2::work(LV2_Worker_Respond_Function respond,
+                            LV2_Worker_Respond_Handle handle,
+                            uint32_t size, const void *data)
+{
+    MidiMetURIs* const uris = &m_uris;
+    const LV2_Atom *atom = (const LV2_Atom *)data;
+
+    if (size < sizeof(LV2_Atom)) return LV2_WORKER_ERR_UNKNOWN;
+
+    deleteRetired(retiredPatterns);
+    deleteRetired(droppedPatterns);
+#ifndef CONFIG_CLICK_SYNTH
+    deleteRetired(retiredSamples);
+    deleteRetired(droppedSamples);
+#endif
+    /* a pattern or samples work_response() found no retire slot for,
+     * sent back once the slots are cleared */
+    if ((atom->type == uris->pattern) || (atom->type == uris->click)) {
+        PointerMessage msg;
+        if (size != sizeof(msg)) return LV2_WORKER_ERR_UNKNOWN;
+        memcpy(&msg, data, sizeof(msg));
+        const LV2_Worker_Status status = respondPointer(respond, handle,
+                                                atom->type, msg.ptr);
+        if (status == LV2_WORKER_SUCCESS) return status;
+        if (atom->type == uris->pattern) {
+            delete (const StepPattern *)msg.ptr;
+        }
+#ifndef CONFIG_CLICK_SYNTH
+        else {
+            delete (const ClickSamples *)msg.ptr;
+        }
+#endif
+        return status;
+    }
+    if ((atom->type == uris->freePattern)
+            || (atom->type == uris->freeSamples)) {
+        PointerMessage msg;
+        if (size != sizeof(msg)) return LV2_WORKER_ERR_UNKNOWN;
+        /* copied out, the host need not align the message */
+        memcpy(&msg, data, sizeof(msg));
+        if (atom->type == uris->freePattern) {
+            delete (const StepPattern *)msg.ptr;
+        }
+#ifndef CONFIG_CLICK_SYNTH
+        else {
+            delete (const ClickSamples *)msg.ptr;
+        }
+#endif
+        return LV2_WORKER_SUCCESS;
+    }
+    if (((atom->type != uris->atom_Object) && (atom->type != uris->atom_Blank))
+            || (size < lv2_atom_total_size(atom))) {
+        return LV2_WORKER_ERR_UNKNOWN;
+    }
+
+    const LV2_Atom *property = NULL, *value = NULL;
+    lv2_atom_object_get((const LV2_Atom_Object *)atom,
+                        uris->patch_property, &property,
+                        uris->patch_value, &value,
+                        NULL);
+    if (!property || (property->type != uris->atom_URID) || !value
+            || !value->size) {
+        return LV2_WORKER_ERR_UNKNOWN;
+    }
+
+    const LV2_URID key = ((const LV2_Atom_URID*)property)->body;
+    const char *text = (const char *)LV2_ATOM_BODY_CONST(value);
+    /* the string body includes the terminating zero */
+    const uint32_t len = strnlen(text, value->size);
+
+    if ((key == uris->pattern) && (value->type == uris->atom_String)) {
+        StepPattern *p = new StepPattern(midiNoteKey);
+        if (!p->parse(text, len)) {
+            delete p;
+            return LV2_WORKER_ERR_UNKNOWN;
+        }
+        const std::string new_program = p->program;
+        const LV2_Worker_Status status = respondPointer(respond, handle,
+                                                uris->pattern, p);
+        if (status != LV2_WORKER_SUCCESS) {
+            delete p;
+            return status;
+        }
+        stateMutex.lock();
+        program = new_program;
+        stateMutex.unlock();
+        return LV2_WORKER_SUCCESS;
+    }
+#ifndef CONFIG_CLICK_SYNTH
+    if (((key == uris->click) || (key == uris->accentClick))
+            && (value->type == uris->atom_Path)) {
+        stateMutex.lock();
+        std::string path = clickPath;
+        std::string accent_path = accentClickPath;
+        stateMutex.unlock();
+
+        if (key == uris->click) {
+            path.assign(text, len);
+        }
+        else {
+            accent_path.assign(text, len);
+        }
+        ClickSamples *s = loadSamples(path, accent_path);
+        if (!s) return LV2_WORKER_ERR_UNKNOWN;
+
+        const LV2_Worker_Status status = respondPointer(respond, handle,
+                                                uris->click, s);
+        if (status != LV2_WORKER_SUCCESS) {
+            delete s;
+            return status;
+        }
+        stateMutex.lock();
+        clickPath = path;
+        accentClickPath = accent_path;
+        stateMutex.unlock();
+        return LV2_WORKER_SUCCESS;
+    }
+#endif
+    return LV2_WORKER_ERR_UNKNOWN;
+}
+
+LV2_Worker_Status MidiMetLV2::respondPointer(
+                            LV2_Worker_Respond_Function respond,
+                            LV2_Worker_Respond_Handle handle,
+                            LV2_URID type, const void *ptr)
+{
+    PointerMessage msg;
+    msg.atom.size = sizeof(msg.ptr);
+    msg.atom.type = type;
+    msg.ptr = ptr;
+    return respond(handle, sizeof(msg), &msg);
+}
+
+LV2_Worker_Status MidiMetLV2::work_response(uint32_t size, const void *data)
+{
+    PointerMessage msg;
+    if (size != sizeof(msg)) return LV2_WORKER_ERR_UNKNOWN;
+    memcpy(&msg, data, sizeof(msg));
+
+    if (msg.atom.type == m_uris.pattern) {
+        const StepPattern *p = (const StepPattern *)msg.ptr;
+        /* without a free retire slot the worker clears them first, if it
+         * cannot be reached the pattern playing stays */
+        if (!hasFreeSlot(retiredPatterns)) {
+            if (schedule->schedule_work(schedule->handle, sizeof(msg), &msg)
+                    == LV2_WORKER_SUCCESS) return LV2_WORKER_SUCCESS;
+            keepRetired(droppedPatterns, p);
+            return LV2_WORKER_ERR_NO_SPACE;
+        }
+        retirePattern(swapPattern(p));
+        return LV2_WORKER_SUCCESS;
+    }
+#ifndef CONFIG_CLICK_SYNTH
+    if (msg.atom.type == m_uris.click) {
+        const ClickSamples *s = (const ClickSamples *)msg.ptr;
+        if (!hasFreeSlot(retiredSamples)) {
+            if (schedule->schedule_work(schedule->handle, sizeof(msg), &msg)
+                    == LV2_WORKER_SUCCESS) return LV2_WORKER_SUCCESS;
+            keepRetired(droppedSamples, s);
+            return LV2_WORKER_ERR_NO_SPACE;
+        }
+        retireSamples(swapSamples(s));
+        return LV2_WORKER_SUCCESS;
+    }
+#endif
+    return LV2_WORKER_ERR_UNKNOWN;
+}
+
+/* Disposes of a replaced pattern without freeing it in the audio thread */
+void MidiMetLV2::retirePattern(const StepPattern *p)
+{
+    if (schedule) {
+        PointerMessage msg;
+        msg.atom.size = sizeof(msg.ptr);
+        msg.atom.type = m_uris.freePattern;
+        msg.ptr = p;
+        if (schedule->schedule_work(schedule->handle, sizeof(msg), &msg)
+                == LV2_WORKER_SUCCESS) return;
+    }
+    /* run() and work_response() only replace a pattern while a slot is
+     * free, unless the host's worker queue stays full */
+    keepRetired(retiredPatterns, p);
+}
+
+#ifndef CONFIG_CLICK_SYNTH
+/* Returns the samples of path and accent_path, empty ones for the
+ * ClickTable waves if both are empty, or NULL if a file cannot be loaded */
+ClickSamples *MidiMetLV2::loadSamples(const std::string& path,
+                            const std::string& accent_path)
+{
+    ClickSamples *s = new ClickSamples;
+    std::string error;
+
+    if ((!path.empty() || !accent_path.empty())
+            && !s->load(path, accent_path, clickTable, sampleRate, error)) {
+        fprintf(stderr, "midimet: %s\n", error.c_str());
+        delete s;
+        return NULL;
+    }
+    return s;
+}
+
+/* Plays s from the next click on, returns the samples played so far */
+const ClickSamples *MidiMetLV2::swapSamples(const ClickSamples *s)
+{
+    const ClickSamples *old = clickSamples;
+
+    clickSamples = s;
+    if (s && s->len) {
+        voices.setWaves(s->waveH.data(), s->waveL.data(), s->audibleH,
+                        s->audibleL);
+    }
+    else if (clickTable) {
+        voices.setWaves(clickTable->waveH, clickTable->waveL,
+                        clickTable->audibleH, clickTable->audibleL);
+    }
+    return old;
+}
+
+/* Disposes of replaced samples the same way as retirePattern() */
+void MidiMetLV2::retireSamples(const ClickSamples *s)
+{
+    if (!s) return;
+    if (schedule) {
+        PointerMessage msg;
+        msg.atom.size = sizeof(msg.ptr);
+        msg.atom.type = m_uris.freeSamples;
+        msg.ptr = s;
+        if (schedule->schedule_work(schedule->handle, sizeof(msg), &msg)
+                == LV2_WORKER_SUCCESS) return;
+    }
+    keepRetired(retiredSamples, s);
+}
+
+/* Returns the feature uri of features, or NULL if the host has none */
+static const void *findFeature(const LV2_Feature *const *features,
+                            const char *uri)
+{
+    for (int i = 0; features && features[i]; ++i) {
+        if (::strcmp(features[i]->URI, uri) == 0) return features[i]->data;
+    }
+    return NULL;
+}
+#endif
+
+LV2_State_Status MidiMetLV2::save(LV2_State_Store_Function store,
+                            LV2_State_Handle handle,
+                            const LV2_Feature *const *features)
+{
+    /* save() may run concurrently with run() and the worker, it only
+     * reads the copies kept under stateMutex */
+    stateMutex.lock();
+    const std::string text = program;
+#ifndef CONFIG_CLICK_SYNTH
+    const std::string paths[2] = {clickPath, accentClickPath};
+#endif
+    stateMutex.unlock();
+
+    LV2_State_Status status = store(handle, m_uris.pattern, text.c_str(),
+                text.size() + 1, m_uris.atom_String,
+                LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+
+#ifndef CONFIG_CLICK_SYNTH
+    const LV2_State_Map_Path *map_path = (const LV2_State_Map_Path *)
+                            findFeature(features, LV2_STATE__mapPath);
+    const LV2_URID keys[2] = {m_uris.click, m_uris.accentClick};
+
+    for (int l1 = 0; (l1 < 2) && (status == LV2_STATE_SUCCESS); l1++) {
+        if (paths[l1].empty()) continue;
+        /* the host maps the path into its session, so that the state
+         * stays valid when the session is moved */
+        char *apath = (map_path) ? map_path->abstract_path(map_path->handle,
+                                        paths[l1].c_str()) : NULL;
+        const char *path = (apath) ? apath : paths[l1].c_str();
+        status = store(handle, keys[l1], path, strlen(path) + 1,
+                    m_uris.atom_Path, LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+        free(apath);
+    }
+#else
+    (void)features;
+#endif
+    return status;
+}
+
+LV2_State_Status MidiMetLV2::restore(LV2_State_Retrieve_Function retrieve,
+                            LV2_State_Handle handle,
+                            const LV2_Feature *const *features)
+{
+    size_t size = 0;
+    uint32_t type = 0;
+    uint32_t flags = 0;
+    const char *text = (const char *)retrieve(handle, m_uris.pattern,
+                                                &size, &type, &flags);
+
+    /* a missing or invalid program restores the default pattern */
+    StepPattern *p = new StepPattern(midiNoteKey);
+    if (text && (type == m_uris.atom_String)) {
+        p->parse(text, strnlen(text, size));
+    }
+
+#ifndef CONFIG_CLICK_SYNTH
+    const LV2_State_Map_Path *map_path = (const LV2_State_Map_Path *)
+                            findFeature(features, LV2_STATE__mapPath);
+    const LV2_URID keys[2] = {m_uris.click, m_uris.accentClick};
+    std::string paths[2];
+
+    for (int l1 = 0; l1 < 2; l1++) {
+        const char *path = (const char *)retrieve(handle, keys[l1],
+                                                &size, &type, &flags);
+        if (!path || (type != m_uris.atom_Path)) continue;
+
+        char *apath = (map_path) ? map_path->absolute_path(map_path->handle,
+                                        path) : NULL;
+        paths[l1] = (apath) ? apath : std::string(path, strnlen(path, size));
+        free(apath);
+    }
+    /* samples that cannot be loaded restore the ClickTable waves */
+    ClickSamples *s = loadSamples(paths[0], paths[1]);
+    if (!s) {
+        paths[0].clear();
+        paths[1].clear();
+        s = new ClickSamples;
+    }
+#else
+    (void)features;
+#endif
+
+    stateMutex.lock();
+    program = p->program;
+#ifndef CONFIG_CLICK_SYNTH
+    clickPath = paths[0];
+    accentClickPath = paths[1];
+#endif
+    stateMutex.unlock();
+
+    deleteRetired(retiredPatterns);
+    deleteRetired(droppedPatterns);
+    /* a restored pattern run() has not taken yet is replaced */
+    delete restoredPattern.exchange(p);
+#ifndef CONFIG_CLICK_SYNTH
+    deleteRetired(retiredSamples);
+    deleteRetired(droppedSamples);
+    delete restoredSamples.exchange(s);
+#endif
+    return LV2_STATE_SUCCESS;
+}
+
+void MidiMetLV2::relocate(uint64_t pos)
+{
+    const int64_t delta = pos - curFrame;
+
+    /* the click tails and pending note offs go on from where they were */
+    voices.shift(delta);
+    noteOffQueue.shift((int64_t)tickAtFrame(pos) - (int64_t)tickAtFrame(curFrame));
+    curFrame = pos;
+    transportFramesDelta = pos;
+
+    const uint64_t step = TPQN / res;
+    setNextTick((tickAtFrame(pos) + step - 1) / step * step);
+    layers.setNextTick(tickAtFrame(pos));
 }
 
 void MidiMetLV2::updatePos(uint64_t pos, float bpm, int speed, bool ignore_pos)
@@ -179,127 +760,556 @@ void MidiMetLV2::updatePos(uint64_t pos, float bpm, int speed, bool ignore_pos)
         if (tempo != bpm) {
             /* Tempo changed */
             tempo = transportBpm;
-            if (hostTransport) {
-                transportSpeed = 0;
+            if (hostTransport && transportSpeed && speed
+                    && (ignore_pos || (pos == curFrame))) {
+                /* rolling on, as through a host tempo ramp, the ticks go
+                 * on from the phase reached instead of restarting from
+                 * the transport origin at the new tempo */
+                reanchorTicks(curFrame, tempo, sampleRate);
+            }
+            else {
+                if (hostTransport) {
+                    transportSpeed = 0;
+                }
+                initTransport();
             }
-            initTransport();
         }
     }
     if (hostTransport) {
         if (!ignore_pos) {
-            const float frames_per_beat = 60.0f / transportBpm * sampleRate;
             transportFramesDelta = pos;
-            tempoChangeTick = pos * TPQN / frames_per_beat;
         }    
         if (transportSpeed != speed) {
             /* Speed changed, e.g. 0 (stop) to 1 (play) */
             transportSpeed = speed;
             curFrame = transportFramesDelta;
             if (transportSpeed) {
-                if (tempoChangeTick > 0) {
+                const uint64_t pos_tick = tickAtFrame(transportFramesDelta);
+                if (pos_tick > 0) {
                     // avoid output of first click when pressing continue
-                    setNextTick((tempoChangeTick / (TPQN / res) + 1) * (TPQN / res));
+                    setNextTick((pos_tick / (TPQN / res) + 1) * (TPQN / res));
+                    layers.setNextTick(pos_tick + 1);
                 }
                 else {
-                    setNextTick(tempoChangeTick);
+                    setNextTick(pos_tick);
+                    layers.setNextTick(pos_tick);
                 }
             }     
         }
     }
 }
 
+/* Follows a system realtime or song position message of the clock input
+ * at curFrame */
+void MidiMetLV2::updateClockIn(const uint8_t *msg, uint32_t size)
+{
+    switch (msg[0]) {
+    case 0xf8:
+        followClock();
+        break;
+    case 0xfa:
+        /* Start plays from the beginning with the next clock */
+        slaveClock = 0;
+        slaveStarting = true;
+        break;
+    case 0xfb:
+        if (!transportSpeed) slaveStarting = true;
+        break;
+    case 0xfc:
+        transportSpeed = 0;
+        slaveStarting = false;
+        break;
+    case 0xf2:
+        /* the position is set while stopped, in units of 6 clocks */
+        if ((size >= 3) && !transportSpeed) {
+            slaveClock = (uint64_t)(((msg[2] & 0x7f) << 7) | (msg[1] & 0x7f))
+                        * (SPP_TICKS / CLOCK_TICKS);
+        }
+        break;
+    }
+}
+
+/* Takes a clock of the input at curFrame. The clock after Start or
+ * Continue anchors the ticks at the song position. Each following clock
+ * sets the tick rate so that the ticks reach the position of the next
+ * clock at the frame ClockFollower predicts for it, which corrects the
+ * phase without ever moving the ticks back, so no click plays twice. */
+void MidiMetLV2::followClock()
+{
+    clockIn.clock(curFrame);
+    if (clockIn.locked()) tempo = clockIn.bpm();
+
+    if (slaveStarting) {
+        const uint64_t tick = slaveClock * CLOCK_TICKS;
+        const uint64_t step = TPQN / res;
+
+        /* pending note offs keep their distance to the position */
+        noteOffQueue.shift((int64_t)tick - (int64_t)tickAtFrame(curFrame));
+        setTickRate(tempo, sampleRate);
+        anchorTicks(curFrame, tick);
+        setNextTick((tick + step - 1) / step * step);
+        layers.setNextTick(tick);
+        transportSpeed = 1;
+        slaveStarting = false;
+    }
+    else if (transportSpeed && clockIn.locked()) {
+        const double ticks = (double)((slaveClock + 1) * CLOCK_TICKS)
+                            - (double)tickAtFrame(curFrame);
+        const double frames = clockIn.nextEdge() - curFrame;
+        const double rate = CLOCK_TICKS / clockIn.period();
+        double steer = (frames >= 1) ? ticks / frames : rate;
+
+        /* within an octave of the clock tempo, a lead is caught up with
+         * by running slower rather than stopping */
+        if (steer < rate / 2) steer = rate / 2;
+        if (steer > rate * 2) steer = rate * 2;
+        reanchorTicks(curFrame, steer * 60. * sampleRate / TPQN, sampleRate);
+    }
+    if (transportSpeed) slaveClock++;
+}
+
+template <int outputs>
 void MidiMetLV2::run (uint32_t nframes )
 {
-    const int32_t timeshift_ticks = timeshift * TPQN * tempo / 60. * 1e-3;
-    float* const   output          = outputPort;
+    if (instrumented) dspStats.beginBlock();
+
     const MidiMetURIs* uris = &m_uris;
-    const uint32_t capacity = outEventBuffer->atom.size;
-    lv2_atom_forge_set_buffer(&forge, (uint8_t*)outEventBuffer, capacity);
-    lv2_atom_forge_sequence_head(&forge, &m_frame, 0);
+    if (outputs & MIDIMET_OUT_MIDI) {
+        const uint32_t capacity = outEventBuffer->atom.size;
+        lv2_atom_forge_set_buffer(&forge, (uint8_t*)outEventBuffer, capacity);
+        lv2_atom_forge_sequence_head(&forge, &m_frame, 0);
+    }
 
     updateParams();
 
+    /* with all retire slots taken, the restored pattern waits */
+    if (hasFreeSlot(retiredPatterns)) {
+        const StepPattern *restored = restoredPattern.exchange(NULL);
+        if (restored) retirePattern(swapPattern(restored));
+    }
+#ifndef CONFIG_CLICK_SYNTH
+    if (hasFreeSlot(retiredSamples)) {
+        const ClickSamples *restored_samples = restoredSamples.exchange(NULL);
+        if (restored_samples) retireSamples(swapSamples(restored_samples));
+    }
+#endif
+
+    /* Position atoms take effect at their frame: the frames before an
+     * atom are rendered with the transport state preceding it */
+    uint32_t f = 0;
     if (inEventBuffer) {
         LV2_ATOM_SEQUENCE_FOREACH(inEventBuffer, event) {
+            uint32_t ev_frame = event->time.frames;
+            if (ev_frame > nframes) ev_frame = nframes;
+
+            // MIDI clock input, system realtime and song position
+            if (clockSlave && (event->body.type == uris->midi_MidiEvent)
+                    && (event->body.size > 0)) {
+                const uint8_t *msg =
+                        (const uint8_t *)LV2_ATOM_BODY_CONST(&event->body);
+                if (msg[0] < 0xf2) continue;
+                if (ev_frame > f) {
+                    runRange<outputs>(f, ev_frame);
+                    f = ev_frame;
+                }
+                updateClockIn(msg, event->body.size);
+            }
             // Control Atom Input
-            if (event && (event->body.type == uris->atom_Object
-                        || event->body.type == uris->atom_Blank)) {
+            else if (event->body.type == uris->atom_Object
+                        || event->body.type == uris->atom_Blank) {
                 const LV2_Atom_Object* obj = (LV2_Atom_Object*)&event->body;
                 if (obj->body.otype == uris->time_Position) {
+                    /* the clock input is the transport of the slave */
+                    if (clockSlave) continue;
+                    if (ev_frame > f) {
+                        runRange<outputs>(f, ev_frame);
+                        f = ev_frame;
+                    }
                     /* Received position information, update */
                     updatePosAtom(obj);
                 }
+                else if (obj->body.otype == uris->patch_Set) {
+                    if (ev_frame > f) {
+                        runRange<outputs>(f, ev_frame);
+                        f = ev_frame;
+                    }
+                    updatePatchAtom(obj);
+                }
             }
         }
     }
+    runRange<outputs>(f, nframes);
+
+    if (instrumented) {
+        dspStats.endBlock(nframes, noteOffQueue.size());
+        if (val[DSP_CYCLES]) *val[DSP_CYCLES] = dspStats.cyclesPerBlock;
+        if (val[DSP_WORST]) *val[DSP_WORST] = dspStats.worstBlockUs;
+        if (val[NOTEOFF_QUEUE]) *val[NOTEOFF_QUEUE] = dspStats.queueDepth;
+        if (val[CLICK_ERROR]) *val[CLICK_ERROR] = dspStats.clickError;
+    }
+}
+
+int32_t MidiMetLV2::timeshiftTicks() const
+{
+    if (ramping(curFrame)) {
+        return timeshift * 1e-3 * sampleRate * tickRateAtFrame(curFrame);
+    }
+    return timeshift * TPQN * tempo / 60. * 1e-3;
+}
+
+/* Renders frames start to end of the block with the current transport
+ * state through the run loop specialized for it */
+template <int outputs>
+void MidiMetLV2::runRange(uint32_t start, uint32_t end)
+{
+    const int32_t timeshift_ticks = timeshiftTicks();
+    if ((outputs & MIDIMET_OUT_MIDI) && (start < end)) {
+        updateClock(start, timeshift_ticks);
+    }
+    const int mode = (transportSpeed ? RUN_ROLLING : 0)
+                    | (hostTransport ? RUN_HOST : 0)
+                    | ((timeshift_ticks > 0) ? RUN_SHIFT_POS : 0)
+                    | (isMuted ? RUN_MUTED : 0);
+    (this->*runFuncs<outputs>(referenceRun)[mode])(start, end, timeshift_ticks);
+}
+
+/* Tables of the run loop instantiations, indexed by RunMode flags */
+template <int outputs>
+const MidiMetLV2::RunFunc* MidiMetLV2::runFuncs(bool perFrame)
+{
+    static const RunFunc perFrameFuncs[RUN_MODES] = {
+        &MidiMetLV2::runPerFrame<outputs, 0>,
+        &MidiMetLV2::runPerFrame<outputs, 1>,
+        &MidiMetLV2::runPerFrame<outputs, 2>,
+        &MidiMetLV2::runPerFrame<outputs, 3>,
+        &MidiMetLV2::runPerFrame<outputs, 4>,
+        &MidiMetLV2::runPerFrame<outputs, 5>,
+        &MidiMetLV2::runPerFrame<outputs, 6>,
+        &MidiMetLV2::runPerFrame<outputs, 7>,
+        &MidiMetLV2::runPerFrame<outputs, 8>,
+        &MidiMetLV2::runPerFrame<outputs, 9>,
+        &MidiMetLV2::runPerFrame<outputs, 10>,
+        &MidiMetLV2::runPerFrame<outputs, 11>,
+        &MidiMetLV2::runPerFrame<outputs, 12>,
+        &MidiMetLV2::runPerFrame<outputs, 13>,
+        &MidiMetLV2::runPerFrame<outputs, 14>,
+        &MidiMetLV2::runPerFrame<outputs, 15>
+    };
+    static const RunFunc segmentedFuncs[RUN_MODES] = {
+        &MidiMetLV2::runSegmented<outputs, 0>,
+        &MidiMetLV2::runSegmented<outputs, 1>,
+        &MidiMetLV2::runSegmented<outputs, 2>,
+        &MidiMetLV2::runSegmented<outputs, 3>,
+        &MidiMetLV2::runSegmented<outputs, 4>,
+        &MidiMetLV2::runSegmented<outputs, 5>,
+        &MidiMetLV2::runSegmented<outputs, 6>,
+        &MidiMetLV2::runSegmented<outputs, 7>,
+        &MidiMetLV2::runSegmented<outputs, 8>,
+        &MidiMetLV2::runSegmented<outputs, 9>,
+        &MidiMetLV2::runSegmented<outputs, 10>,
+        &MidiMetLV2::runSegmented<outputs, 11>,
+        &MidiMetLV2::runSegmented<outputs, 12>,
+        &MidiMetLV2::runSegmented<outputs, 13>,
+        &MidiMetLV2::runSegmented<outputs, 14>,
+        &MidiMetLV2::runSegmented<outputs, 15>
+    };
+
+    return perFrame ? perFrameFuncs : segmentedFuncs;
+}
+
+/* Reference path evaluating tick, click and note off state for each frame */
+template <int outputs, int mode>
+void MidiMetLV2::runPerFrame(uint32_t start, uint32_t end,
+                            int32_t timeshift_ticks)
+{
+    float* const   output          = outputPort;
+
+    for (uint32_t f = start ; f < end; f++) {
+        processFrame<outputs, mode>(f, timeshift_ticks);
+
+        if (!(outputs & MIDIMET_OUT_AUDIO)) {
+            curFrame++;
+            continue;
+        }
+        voices.render(output + f, curFrame, 1);
+        curFrame++;
+    }
+}
 
-        // MIDI Output
-    for (uint32_t f = 0 ; f < nframes; f++) {
-        curTick = (uint64_t)(curFrame - transportFramesDelta)
-                        *TPQN*tempo/60/sampleRate + tempoChangeTick;
-        if (timeshift_ticks > 0) {
-            if (curTick > (uint32_t)(timeshift_ticks)) {
-                curTick -= timeshift_ticks;
+/* Block path: the frame offsets of the next click and of the next note off
+ * are solved once, and the audio in between is rendered without per-frame
+ * tick evaluation. Event frames go through processFrame() exactly as in
+ * runPerFrame(), so both paths produce the same output. */
+template <int outputs, int mode>
+void MidiMetLV2::runSegmented(uint32_t start, uint32_t end,
+                            int32_t timeshift_ticks)
+{
+    float* const   output          = outputPort;
+    const uint32_t nframes = end - start;
+    uint32_t f = start;
+
+    const bool clock = (outputs & MIDIMET_OUT_MIDI) && (mode & RUN_ROLLING)
+                        && clockRunning;
+    /* the main click and the layers share one schedule */
+    int64_t next_tick = (layers.next < nextTick) ? layers.next : nextTick;
+
+    /* Silence fast path: no click tail sounding, no note off pending and
+     * no click or MIDI clock due in this range */
+    if (!clickSounding() && noteOffQueue.empty() && (!(mode & RUN_ROLLING)
+            || ((framesUntilTick<mode>(next_tick, timeshift_ticks, nframes) == nframes)
+            && (!clock || (framesUntilClock(timeshift_ticks, nframes) == nframes))))) {
+        if (outputs & MIDIMET_OUT_AUDIO) audioZero(output + start, nframes);
+        curFrame += nframes;
+        return;
+    }
+
+    while (f < end) {
+        uint32_t seglen = end - f;
+
+        if (mode & RUN_ROLLING) {
+            next_tick = (layers.next < nextTick) ? layers.next : nextTick;
+            seglen = framesUntilTick<mode>(next_tick, timeshift_ticks, seglen);
+        }
+        if (clock) {
+            seglen = framesUntilClock(timeshift_ticks, seglen);
+        }
+        if (!noteOffQueue.empty()) {
+            if ((mode & RUN_HOST) && !(mode & RUN_ROLLING)) {
+                seglen = 0;
+            }
+            else {
+                seglen = framesUntilTick<mode>(noteOffQueue.nextTick(),
+                                        timeshift_ticks, seglen);
             }
         }
-        else {
+
+        renderSegment<outputs>(output + f, seglen);
+        f += seglen;
+        if (f == end) break;
+
+        processFrame<outputs, mode>(f, timeshift_ticks);
+        renderSegment<outputs>(output + f, 1);
+        f++;
+    }
+}
+
+template <int outputs, int mode>
+void MidiMetLV2::processFrame(uint32_t f, int32_t timeshift_ticks)
+{
+    const uint64_t transport_tick = tickAtFrame(curFrame);
+
+    /* the clock goes first, so that a Start precedes the notes at its frame */
+    if ((outputs & MIDIMET_OUT_MIDI) && (mode & RUN_ROLLING) && clockRunning
+            && ((int64_t)transport_tick >= (int64_t)nextClockTick + timeshift_ticks)) {
+        sendClock(f);
+    }
+
+    curTick = transport_tick;
+    if (mode & RUN_SHIFT_POS) {
+        if (curTick > (uint32_t)(timeshift_ticks)) {
             curTick -= timeshift_ticks;
         }
-        if ((curTick >= (uint64_t)nextTick) && (transportSpeed)) {
-            getNextFrame(nextTick);
-            if (!outFrame[0].muted && !isMuted) {
+    }
+    else {
+        curTick -= timeshift_ticks;
+    }
+    if ((mode & RUN_ROLLING) && (curTick >= (uint64_t)nextTick)) {
+        if (instrumented && (nextTick + timeshift_ticks >= 0)) {
+            dspStats.clickPlaced(framesPastTick(curFrame,
+                                            nextTick + timeshift_ticks));
+        }
+        getNextFrame(nextTick);
+        if (!(mode & RUN_MUTED) && !outFrame[0].muted) {
+            const MidiEvent noteoff = {EV_NOTEOFF, channelOut,
+                                        outFrame[0].data, 127};
+            if (outputs & MIDIMET_OUT_AUDIO) {
+                voices.start(curFrame, accent, outFrame[0].value);
+            }
+            /* a full queue drops the MIDI note rather than leaving it
+             * hanging, the audio click is still played */
+            if ((outputs & MIDIMET_OUT_MIDI)
+                    && noteOffQueue.push(curTick + notelength / 4, noteoff)) {
                 unsigned char d[3];
                 d[0] = 0x90 + channelOut;
                 d[1] = outFrame[0].data;
-                d[2] = vel;
+                d[2] = outFrame[0].value;
                 forgeMidiEvent(f, d, 3);
-                soundOnFrame = curFrame;
-                evTickQueue[bufPtr] = curTick + notelength / 4;
-                evQueue[bufPtr] = outFrame[0].data;
-                bufPtr++;
-            }
-            float pos = (float)getFramePtr();
-            *val[CURSOR_POS] = pos;
-        }
-        // Note Off Queue handling
-        uint64_t noteofftick = evTickQueue[0];
-        int idx = 0;
-        for (int l1 = 0; l1 < bufPtr; l1++) {
-            uint64_t tmptick = evTickQueue[l1];
-            if (noteofftick > tmptick) {
-                idx = l1;
-                noteofftick = tmptick;
             }
         }
-        if ( (bufPtr) && ((curTick >= noteofftick)
-                || (hostTransport && !transportSpeed)) ) {
-            int outval = evQueue[idx];
-            for (int l4 = idx ; l4 < (bufPtr - 1);l4++) {
-                evQueue[l4] = evQueue[l4 + 1];
-                evTickQueue[l4] = evTickQueue[l4 + 1];
-            }
-            bufPtr--;
-
-            unsigned char d[3];
-            d[0] = 0x80 + channelOut;
-            d[1] = outval;
-            d[2] = 127;
-            forgeMidiEvent(f, d, 3);
-        }
-        elapsed_len  = curFrame - soundOnFrame;
-        if (elapsed_len < wave_len) {
-            if (framePtr == 1) {
-                output[f] = wave_h[elapsed_len] * vel / 128;
-                }
-            else {
-                output[f] = wave_l[elapsed_len] * vel / 128;
+        float pos = (float)getFramePtr();
+        *val[CURSOR_POS] = pos;
+    }
+    if ((mode & RUN_ROLLING) && (curTick >= (uint64_t)layers.next)) {
+        playLayers<outputs, mode>(f);
+    }
+    // Note Off Queue handling
+    if ( (outputs & MIDIMET_OUT_MIDI) && (!noteOffQueue.empty())
+            && ((curTick >= noteOffQueue.nextTick())
+            || ((mode & RUN_HOST) && !(mode & RUN_ROLLING))) ) {
+        const MidiEvent& noteoff = noteOffQueue.next();
+        unsigned char d[3];
+        d[0] = 0x80 + noteoff.channel;
+        d[1] = noteoff.data;
+        d[2] = noteoff.value;
+        noteOffQueue.pop();
+        forgeMidiEvent(f, d, 3);
+    }
+}
+
+/* Plays the clicks of the layers due at curTick, at frame f */
+template <int outputs, int mode>
+void MidiMetLV2::playLayers(uint32_t f)
+{
+    int due[LAYER_MAX];
+    const int ndue = layers.fire(curTick, due);
+
+    if (mode & RUN_MUTED) return;
+
+    for (int l1 = 0; l1 < ndue; l1++) {
+        const int layer = due[l1];
+        const bool layer_accent = layers.accent[layer];
+        int value = (int)(vel * layers.gain[layer] + 0.5f);
+        if (value < 1) value = 1;
+        if (value > 127) value = 127;
+
+        if (outputs & MIDIMET_OUT_AUDIO) {
+            voices.start(curFrame, layer_accent, value);
+        }
+        if (outputs & MIDIMET_OUT_MIDI) {
+            int note = layers.note[layer];
+            if (layer_accent && (note < 116)) note += 12;
+            const MidiEvent noteoff = {EV_NOTEOFF, layers.channel[layer],
+                                        note, 127};
+            if (noteOffQueue.push(curTick + notelength / 4, noteoff)) {
+                unsigned char d[3];
+                d[0] = 0x90 + layers.channel[layer];
+                d[1] = note;
+                d[2] = value;
+                forgeMidiEvent(f, d, 3);
             }
         }
-        else {
-            output[f] = 0.0f;
+    }
+}
+
+bool MidiMetLV2::clickSounding()
+{
+    return voices.sounding(curFrame);
+}
+
+/* Renders nframes of click tails, or silence, starting at curFrame. There
+ * are no events inside the segment, so the voices sounding are fixed. */
+template <int outputs>
+void MidiMetLV2::renderSegment(float *output, uint32_t nframes)
+{
+    if (outputs & MIDIMET_OUT_AUDIO) voices.render(output, curFrame, nframes);
+    curFrame += nframes;
+}
+
+/* Number of frames from curFrame until tickAtFrame() reaches tick, or limit
+ * if that does not happen within limit frames */
+uint32_t MidiMetLV2::framesUntilRawTick(uint64_t tick, uint32_t limit)
+{
+    if (!limit || tickAtFrame(curFrame) >= tick) return 0;
+
+    const uint64_t frame = frameAtTick(tick);
+    if (frame - curFrame >= limit) return limit;
+
+    return frame - curFrame;
+}
+
+/* Number of frames from curFrame until the timeshifted tick reaches tick.
+ * A positive timeshift is not applied before the transport tick exceeds it,
+ * so the shifted tick drops once, which is handled as a second range. */
+template <int mode>
+uint32_t MidiMetLV2::framesUntilTick(uint64_t tick, int32_t timeshift_ticks,
+                                    uint32_t limit)
+{
+    if (!(mode & RUN_SHIFT_POS)) {
+        const uint64_t shift = -(int64_t)timeshift_ticks;
+        if (tick <= shift) return 0;
+        return framesUntilRawTick(tick - shift, limit);
+    }
+
+    const uint64_t shift = timeshift_ticks;
+    uint32_t nf = framesUntilRawTick(tick, limit);
+    if ((nf < limit) && (tickAtFrame(curFrame + nf) > shift)) {
+        uint64_t tick2 = tick + shift;
+        if (tick2 < shift + 1) tick2 = shift + 1;
+        nf = framesUntilRawTick(tick2, limit);
+    }
+    return nf;
+}
+
+/* Follows the clock switch and the transport at frame f, the start of a
+ * range and thus the frame of any transport change: sends Stop when the
+ * clock or the transport stops or the position jumps, and schedules Start
+ * or Song Position Pointer and Continue to go with the next clock */
+void MidiMetLV2::updateClock(uint32_t f, int32_t timeshift_ticks)
+{
+    const bool on = clockOut && transportSpeed;
+
+    if (!on && !clockRunning) return;
+
+    const int64_t tick = (int64_t)tickAtFrame(curFrame) - timeshift_ticks;
+    const int64_t next = nextClockTick;
+    if (clockRunning) {
+        /* the next clock stays within a clock period of the position, or
+         * a pending Continue within a position unit, unless the transport
+         * jumped. A pending Start waits for the clock timeline to reach
+         * zero. */
+        const int64_t ahead = (clockPending == EV_CONTINUE) ? SPP_TICKS
+                                                            : CLOCK_TICKS;
+        if (on && ((clockPending == EV_START)
+                || ((next + CLOCK_TICKS > tick) && (next <= tick + ahead)))) {
+            return;
         }
-        curFrame++;
+        if (clockPending == EV_NONE) {
+            const uint8_t d = 0xfc;
+            forgeMidiEvent(f, &d, 1);
+        }
+        clockPending = EV_NONE;
+        clockRunning = false;
+        if (!on) return;
     }
+
+    if (tick < CLOCK_TICKS) {
+        nextClockTick = 0;
+        clockPending = EV_START;
+    }
+    else {
+        /* the receiver continues from the position at the next clock */
+        nextClockTick = (tick + SPP_TICKS - 1) / SPP_TICKS * SPP_TICKS;
+        clockPending = EV_CONTINUE;
+    }
+    clockRunning = true;
+}
+
+/* Number of frames from curFrame until the next clock is due, or limit */
+uint32_t MidiMetLV2::framesUntilClock(int32_t timeshift_ticks, uint32_t limit)
+{
+    const int64_t tick = (int64_t)nextClockTick + timeshift_ticks;
+
+    if (tick <= 0) return 0;
+    return framesUntilRawTick(tick, limit);
+}
+
+/* Sends the clock due at frame f, preceded by a pending Start or Continue */
+void MidiMetLV2::sendClock(uint32_t f)
+{
+    if (clockPending == EV_CONTINUE) {
+        uint64_t spp = nextClockTick / SPP_TICKS;
+        if (spp > 0x3fff) spp = 0x3fff;
+        const uint8_t d[3] = {0xf2, (uint8_t)(spp & 0x7f), (uint8_t)(spp >> 7)};
+        forgeMidiEvent(f, d, 3);
+    }
+    if (clockPending != EV_NONE) {
+        const uint8_t d = (clockPending == EV_START) ? 0xfa : 0xfb;
+        forgeMidiEvent(f, &d, 1);
+        clockPending = EV_NONE;
+    }
+    const uint8_t d = 0xf8;
+    forgeMidiEvent(f, &d, 1);
+    nextClockTick += CLOCK_TICKS;
 }
 
 void MidiMetLV2::forgeMidiEvent(uint32_t f, const uint8_t* const buffer, uint32_t size)
@@ -314,83 +1324,187 @@ void MidiMetLV2::forgeMidiEvent(uint32_t f, const uint8_t* const buffer, uint32_
     lv2_atom_forge_pad(&forge, sizeof(LV2_Atom) + size);
 }
 
+/* Applies the control ports that changed since the last block */
 void MidiMetLV2::updateParams()
 {
-    if (vel != *val[VELOCITY]) {
-        vel = *val[VELOCITY];
-        updateVelocity(vel);
-    }
-
-    if (notelength != sliderToTickLen(*val[NOTELENGTH])) {
-        updateNoteLength(sliderToTickLen(*val[NOTELENGTH]));
-    }
-
-    if (timeshift != (int)*val[TIMESHIFT]) {
-        updateTimeShift((int)*val[TIMESHIFT]);
-    }
-
-
-    if (res != seqResValues[(int)*val[RESOLUTION]]) {
-        updateResolution(seqResValues[(int)*val[RESOLUTION]]);
+    for (size_t l1 = 0; l1 < sizeof(inputFields) / sizeof(inputFields[0]); l1++) {
+        const int field = inputFields[l1];
+        const float v = *val[field];
+        if (v != portValue[field]) {
+            applyParam(field, v);
+            portValue[field] = v;
+        }
     }
 
-    if (size != seqSizeValues[(int)*val[SIZE]]) {
-        updateSize(seqSizeValues[(int)*val[SIZE]]);
+    if (hostTransport && !clockSlave && !transportAtomReceived) {
+        updatePos(  (uint64_t)*val[HOST_POSITION],
+                    (float)*val[HOST_TEMPO],
+                    (int)*val[HOST_SPEED],
+                    false);
     }
 
-    if (isMuted != (bool)*val[MUTE]) setMuted((bool)(*val[MUTE]));
+}
 
-    if (internalTempo != *val[TEMPO]) {
-        internalTempo = *val[TEMPO];
-        if (!hostTransport) {
+/* Sets the control of field to value, from its port or from patch:Set,
+ * where the setting it results in differs from the current one */
+void MidiMetLV2::applyParam(int field, float value)
+{
+    switch (field) {
+    case VELOCITY:
+        if (vel != (int)value) updateVelocity((int)value);
+        break;
+    case NOTELENGTH:
+        if (notelength != sliderToTickLen(value)) {
+            updateNoteLength(sliderToTickLen(value));
+        }
+        break;
+    case TIMESHIFT:
+        if (timeshift != (int)value) updateTimeShift((int)value);
+        break;
+    case RESOLUTION:
+        if (res != seqResValues[(int)value]) {
+            updateResolution(seqResValues[(int)value]);
+        }
+        break;
+    case SIZE:
+        if (size != seqSizeValues[(int)value]) {
+            updateSize(seqSizeValues[(int)value]);
+        }
+        break;
+    case MUTE:
+        if (isMuted != (bool)value) setMuted((bool)value);
+        break;
+    case CH_OUT:
+        channelOut = (int)value & 0x0f;
+        break;
+    case TEMPO:
+        if (internalTempo != value) {
+            internalTempo = value;
+            /* the tempo of the first block is taken at once */
+            if (!hostTransport && !tempoFromHost && rampBars
+                    && !std::isnan(portValue[TEMPO])) {
+                rampTempo();
+            }
+            else if (!hostTransport) {
+                initTransport();
+            }
+        }
+        break;
+    case RAMP_LENGTH:
+        rampBars = (value > 0) ? (int)value : 0;
+        break;
+    case RAMP_SHAPE:
+        rampShape = (value >= 1) ? RAMP_EXPONENTIAL : RAMP_LINEAR;
+        break;
+    case TEMPO_MODE:
+        if (tempoFromHost != (bool)value) {
+            tempoFromHost = (bool)value;
+            /* the clock slave takes its tempo from the clock in any case */
+            if (!clockSlave) initTransport();
+        }
+        break;
+    case TRANSPORT_MODE: {
+        const int transport_mode = (int)value;
+        if ((hostTransport != (transport_mode > 0))
+                || (clockSlave != (transport_mode == 2))) {
+            hostTransport = (transport_mode > 0);
+            clockSlave = (transport_mode == 2);
+            if (hostTransport) {
+                tempoFromHost = true;
+            }
             initTransport();
         }
+        break;
     }
-
-    if (tempoFromHost != (bool)(*val[TEMPO_MODE])) {
-        tempoFromHost = (bool)(*val[TEMPO_MODE]);
-        initTransport();
-    }
-
-    if (hostTransport != (bool)(*val[TRANSPORT_MODE])) {
-        hostTransport = (bool)(*val[TRANSPORT_MODE]);
-        if (hostTransport) {
-            tempoFromHost = true;
+    case MIDI_CLOCK:
+        clockOut = (value != 0);
+        break;
+    default:
+        if (field >= LAYER_RESOLUTION) {
+            applyLayerParam((field - LAYER_RESOLUTION) / LAYER_FIELDS,
+                    LAYER_RESOLUTION + (field - LAYER_RESOLUTION) % LAYER_FIELDS,
+                    value);
         }
-         initTransport();
+        break;
     }
+}
 
-    if (hostTransport && !transportAtomReceived) {
-        updatePos(  (uint64_t)*val[HOST_POSITION],
-                    (float)*val[HOST_TEMPO],
-                    (int)*val[HOST_SPEED],
-                    false);
+/* Sets the control of the click layer given by its first layer field */
+void MidiMetLV2::applyLayerParam(int layer, int field, float value)
+{
+    switch (field) {
+    case LAYER_RESOLUTION:
+        layers.setResolution(layer, seqResValues[(int)value]);
+        break;
+    case LAYER_SIZE:
+        layers.setSize(layer, seqSizeValues[(int)value]);
+        break;
+    case LAYER_NOTE:
+        layers.note[layer] = (int)value & 0x7f;
+        break;
+    case LAYER_CH_OUT:
+        layers.channel[layer] = (int)value & 0x0f;
+        break;
+    case LAYER_GAIN: {
+        /* a layer turned on joins at the click tick of curFrame */
+        const int64_t tick = (int64_t)tickAtFrame(curFrame) - timeshiftTicks();
+        layers.setGain(layer, value, (tick > 0) ? tick : 0);
+        break;
+    }
     }
+}
 
+/* Ramps the free running transport from the tempo reached at curFrame
+ * to internalTempo over rampBars bars, which are pattern lengths */
+void MidiMetLV2::rampTempo()
+{
+    tempo = internalTempo;
+    transportFramesDelta = curFrame;
+    rampTicks(curFrame, tempo, (uint64_t)rampBars * size * TPQN, rampShape,
+                sampleRate);
 }
 
 void MidiMetLV2::initTransport()
 {
-    if (tempoFromHost) {
+    if (clockSlave) {
+        tempo = clockIn.locked() ? clockIn.bpm() : internalTempo;
+    }
+    else if (tempoFromHost) {
         tempo = transportBpm;
     }
     else {
         tempo = internalTempo;
     }
     
-    if (!hostTransport) {
+    if (clockSlave) {
+        /* stopped until the clock master starts or continues */
+        reanchorTicks(curFrame, tempo, sampleRate);
+        transportSpeed = 0;
+        slaveStarting = false;
+        setBarPosition(0, 0, 0);
+    }
+    else if (!hostTransport) {
+        /* keep the tick phase reached so far and continue at the new tempo */
         transportFramesDelta = curFrame;
-        if (curTick > 0) tempoChangeTick = curTick;
+        reanchorTicks(curFrame, tempo, sampleRate);
         transportSpeed = 1;
+        /* accents follow the pattern again */
+        setBarPosition(0, 0, 0);
     }
     else {
+        /* host frames map to ticks from the transport origin */
+        setTickRate(tempo, sampleRate);
+        anchorTicks(0, 0);
         transportSpeed = 0;
-        setNextTick(tempoChangeTick);
+        setNextTick(tickAtFrame(transportFramesDelta));
+        layers.setNextTick(tickAtFrame(transportFramesDelta));
     }
 }
 
 void MidiMetLV2::activate (void)
 {
+    dspStats.reset(sampleRate);
+    clockIn.reset(sampleRate);
     initTransport();
 }
 
@@ -406,6 +1520,20 @@ static LV2_Handle MidiMetLV2_instantiate (
     return new MidiMetLV2(sample_rate, host_features);
 }
 
+static LV2_Handle MidiMetLV2_instantiate_midi (
+    const LV2_Descriptor *, double sample_rate, const char *,
+    const LV2_Feature *const *host_features )
+{
+    return new MidiMetLV2(sample_rate, host_features, MIDIMET_OUT_MIDI);
+}
+
+static LV2_Handle MidiMetLV2_instantiate_audio (
+    const LV2_Descriptor *, double sample_rate, const char *,
+    const LV2_Feature *const *host_features )
+{
+    return new MidiMetLV2(sample_rate, host_features, MIDIMET_OUT_AUDIO);
+}
+
 static void MidiMetLV2_connect_port (
     LV2_Handle instance, uint32_t port, void *data )
 {
@@ -414,11 +1542,12 @@ static void MidiMetLV2_connect_port (
         pPlugin->connect_port(port, data);
 }
 
+template <int outputs>
 static void MidiMetLV2_run ( LV2_Handle instance, uint32_t nframes )
 {
     MidiMetLV2 *pPlugin = static_cast<MidiMetLV2 *> (instance);
     if (pPlugin)
-        pPlugin->run(nframes);
+        pPlugin->run<outputs>(nframes);
 }
 
 static void MidiMetLV2_activate ( LV2_Handle instance )
@@ -442,20 +1571,104 @@ static void MidiMetLV2_cleanup ( LV2_Handle instance )
         delete pPlugin;
 }
 
+static LV2_Worker_Status MidiMetLV2_work (
+    LV2_Handle instance, LV2_Worker_Respond_Function respond,
+    LV2_Worker_Respond_Handle handle, uint32_t size, const void *data )
+{
+    MidiMetLV2 *pPlugin = static_cast<MidiMetLV2 *> (instance);
+    if (!pPlugin) return LV2_WORKER_ERR_UNKNOWN;
+    return pPlugin->work(respond, handle, size, data);
+}
+
+static LV2_Worker_Status MidiMetLV2_work_response (
+    LV2_Handle instance, uint32_t size, const void *data )
+{
+    MidiMetLV2 *pPlugin = static_cast<MidiMetLV2 *> (instance);
+    if (!pPlugin) return LV2_WORKER_ERR_UNKNOWN;
+    return pPlugin->work_response(size, data);
+}
+
+static LV2_State_Status MidiMetLV2_save (
+    LV2_Handle instance, LV2_State_Store_Function store,
+    LV2_State_Handle handle, uint32_t, const LV2_Feature *const *features )
+{
+    MidiMetLV2 *pPlugin = static_cast<MidiMetLV2 *> (instance);
+    if (!pPlugin) return LV2_STATE_ERR_UNKNOWN;
+    return pPlugin->save(store, handle, features);
+}
+
+static LV2_State_Status MidiMetLV2_restore (
+    LV2_Handle instance, LV2_State_Retrieve_Function retrieve,
+    LV2_State_Handle handle, uint32_t, const LV2_Feature *const *features )
+{
+    MidiMetLV2 *pPlugin = static_cast<MidiMetLV2 *> (instance);
+    if (!pPlugin) return LV2_STATE_ERR_UNKNOWN;
+    return pPlugin->restore(retrieve, handle, features);
+}
+
+static const void *MidiMetLV2_extension_data ( const char *uri )
+{
+    static const LV2_Worker_Interface worker = {
+        MidiMetLV2_work,
+        MidiMetLV2_work_response,
+        NULL
+    };
+    static const LV2_State_Interface state = {
+        MidiMetLV2_save,
+        MidiMetLV2_restore
+    };
+
+    if (!strcmp(uri, LV2_WORKER__interface)) return &worker;
+    if (!strcmp(uri, LV2_STATE__interface)) return &state;
+    return NULL;
+}
+
 static const LV2_Descriptor MidiMetLV2_descriptor =
 {
     MIDIMET_LV2_URI,
     MidiMetLV2_instantiate,
     MidiMetLV2_connect_port,
     MidiMetLV2_activate,
-    MidiMetLV2_run,
+    MidiMetLV2_run<MIDIMET_OUT_AUDIO | MIDIMET_OUT_MIDI>,
     MidiMetLV2_deactivate,
     MidiMetLV2_cleanup,
-    NULL
+    MidiMetLV2_extension_data
+};
+
+static const LV2_Descriptor MidiMetLV2_midi_descriptor =
+{
+    MIDIMET_MIDI_LV2_URI,
+    MidiMetLV2_instantiate_midi,
+    MidiMetLV2_connect_port,
+    MidiMetLV2_activate,
+    MidiMetLV2_run<MIDIMET_OUT_MIDI>,
+    MidiMetLV2_deactivate,
+    MidiMetLV2_cleanup,
+    MidiMetLV2_extension_data
+};
+
+static const LV2_Descriptor MidiMetLV2_audio_descriptor =
+{
+    MIDIMET_AUDIO_LV2_URI,
+    MidiMetLV2_instantiate_audio,
+    MidiMetLV2_connect_port,
+    MidiMetLV2_activate,
+    MidiMetLV2_run<MIDIMET_OUT_AUDIO>,
+    MidiMetLV2_deactivate,
+    MidiMetLV2_cleanup,
+    MidiMetLV2_extension_data
 };
 
 LV2_SYMBOL_EXPORT const LV2_Descriptor *lv2_descriptor ( uint32_t index )
 {
-    return (index == 0 ? &MidiMetLV2_descriptor : NULL);
+    switch (index) {
+    case 0:
+        return &MidiMetLV2_descriptor;
+    case 1:
+        return &MidiMetLV2_midi_descriptor;
+    case 2:
+        return &MidiMetLV2_audio_descriptor;
+    default:
+        return NULL;
+    }
 }
-
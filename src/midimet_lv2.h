@@ -25,9 +25,39 @@
 #ifndef MIDIMET_LV2_H
 #define MIDIMET_LV2_H
 
+#include <atomic>
+#include <mutex>
+#include <string>
+#include "config.h"
 #include "midimet.h"
+#include "eventqueue.h"
+#include "clicktable.h"
+#include "clicksynth.h"
+#include "clicksamples.h"
+#include "clicklayers.h"
+#include "clickvoices.h"
+#include "clockfollower.h"
+#include "dspstats.h"
 
 #define MIDIMET_LV2_URI "https://github.com/emuse/midimet"
+#define MIDIMET_MIDI_LV2_URI MIDIMET_LV2_URI "#midi"
+#define MIDIMET_AUDIO_LV2_URI MIDIMET_LV2_URI "#audio"
+#define MIDIMET_LV2_PREFIX MIDIMET_LV2_URI "#"
+
+/* Outputs of the plugin variants, the run() code of absent outputs is
+ * removed at compile time */
+#define MIDIMET_OUT_AUDIO   1
+#define MIDIMET_OUT_MIDI    2
+
+/* MIDI clock period and Song Position Pointer unit in ticks */
+#define CLOCK_TICKS     (TPQN / 24)
+#define SPP_TICKS       (TPQN / 4)
+/* Control fields of each click layer */
+#define LAYER_FIELDS    5
+/* Largest beat phase correction per block during a host tempo ramp in ticks */
+#define RAMP_MAX_CORRECTION     (TPQN / 32)
+/* Replaced patterns or samples the audio thread can hold for deletion */
+#define RETIRE_SLOTS    4
 
 #include "lv2/lv2plug.in/ns/ext/urid/urid.h"
 #include "lv2/lv2plug.in/ns/ext/atom/atom.h"
@@ -35,6 +65,9 @@
 #include "lv2/lv2plug.in/ns/ext/midi/midi.h"
 #include "lv2/lv2plug.in/ns/ext/atom/util.h"
 #include "lv2/lv2plug.in/ns/ext/time/time.h"
+#include "lv2/lv2plug.in/ns/ext/patch/patch.h"
+#include "lv2/lv2plug.in/ns/ext/worker/worker.h"
+#include "lv2/lv2plug.in/ns/ext/state/state.h"
 #include "lv2/lv2plug.in/ns/lv2core/lv2.h"
 
 
@@ -45,16 +78,28 @@ typedef struct {
     LV2_URID atom_Int;
     LV2_URID atom_Vector;
     LV2_URID atom_Long;
+    LV2_URID atom_URID;
     LV2_URID atom_String;
+    LV2_URID atom_Path;
+    LV2_URID atom_Double;
     LV2_URID atom_eventTransfer;
     LV2_URID atom_Resource;
     LV2_URID time_Position;
     LV2_URID time_frame;
     LV2_URID time_barBeat;
+    LV2_URID time_beatsPerBar;
     LV2_URID time_beatsPerMinute;
     LV2_URID time_speed;
     LV2_URID midi_MidiEvent;
     LV2_URID atom_Sequence;
+    LV2_URID patch_Set;
+    LV2_URID patch_property;
+    LV2_URID patch_value;
+    LV2_URID pattern;
+    LV2_URID freePattern;
+    LV2_URID click;
+    LV2_URID accentClick;
+    LV2_URID freeSamples;
 } MidiMetURIs;
 
 static inline void map_uris(LV2_URID_Map* urid_map, MidiMetURIs* uris) {
@@ -64,24 +109,45 @@ static inline void map_uris(LV2_URID_Map* urid_map, MidiMetURIs* uris) {
     uris->atom_Int            = urid_map->map(urid_map->handle, LV2_ATOM__Int);
     uris->atom_Vector         = urid_map->map(urid_map->handle, LV2_ATOM__Vector);
     uris->atom_Long           = urid_map->map(urid_map->handle, LV2_ATOM__Long);
+    uris->atom_URID           = urid_map->map(urid_map->handle, LV2_ATOM__URID);
     uris->atom_String         = urid_map->map(urid_map->handle, LV2_ATOM__String);
+    uris->atom_Path           = urid_map->map(urid_map->handle, LV2_ATOM__Path);
+    uris->atom_Double         = urid_map->map(urid_map->handle, LV2_ATOM__Double);
     uris->atom_eventTransfer  = urid_map->map(urid_map->handle, LV2_ATOM__eventTransfer);
     uris->atom_Resource       = urid_map->map(urid_map->handle, LV2_ATOM__Resource);
     uris->time_Position       = urid_map->map(urid_map->handle, LV2_TIME__Position);
     uris->time_frame          = urid_map->map(urid_map->handle, LV2_TIME__frame);
     uris->time_barBeat        = urid_map->map(urid_map->handle, LV2_TIME__barBeat);
+    uris->time_beatsPerBar    = urid_map->map(urid_map->handle, LV2_TIME__beatsPerBar);
     uris->time_beatsPerMinute = urid_map->map(urid_map->handle, LV2_TIME__beatsPerMinute);
     uris->time_speed          = urid_map->map(urid_map->handle, LV2_TIME__speed);
     uris->midi_MidiEvent      = urid_map->map(urid_map->handle, LV2_MIDI__MidiEvent);
     uris->atom_Sequence       = urid_map->map(urid_map->handle, LV2_ATOM__Sequence);
+    uris->patch_Set           = urid_map->map(urid_map->handle, LV2_PATCH__Set);
+    uris->patch_property      = urid_map->map(urid_map->handle, LV2_PATCH__property);
+    uris->patch_value         = urid_map->map(urid_map->handle, LV2_PATCH__value);
+    uris->pattern             = urid_map->map(urid_map->handle, MIDIMET_LV2_PREFIX "pattern");
+    uris->freePattern         = urid_map->map(urid_map->handle, MIDIMET_LV2_PREFIX "freePattern");
+    uris->click               = urid_map->map(urid_map->handle, MIDIMET_LV2_PREFIX "click");
+    uris->accentClick         = urid_map->map(urid_map->handle, MIDIMET_LV2_PREFIX "accentClick");
+    uris->freeSamples         = urid_map->map(urid_map->handle, MIDIMET_LV2_PREFIX "freeSamples");
 }
 
+/* Worker message carrying a pattern or click samples built by the worker
+ * to run(), or a replaced one back to the worker for deletion */
+typedef struct {
+    LV2_Atom atom;      /**< type is MidiMetURIs::pattern, click,
+                             freePattern or freeSamples */
+    const void *ptr;
+} PointerMessage;
+
 
 class MidiMetLV2 : public MidiMet
 {
 public:
 
-        MidiMetLV2(double sample_rate, const LV2_Feature *const *host_features);
+        MidiMetLV2(double sample_rate, const LV2_Feature *const *host_features,
+                    int outputs = MIDIMET_OUT_AUDIO | MIDIMET_OUT_MIDI);
 
         ~MidiMetLV2();
         /* this enum is for the float value array and shifted by 2 compared with the
@@ -100,7 +166,21 @@ public:
             HOST_TEMPO = 10,
             HOST_POSITION = 11,
             HOST_SPEED = 12,
-            TIMESHIFT = 13
+            TIMESHIFT = 13,
+            DSP_CYCLES = 14, //output
+            DSP_WORST = 15, //output
+            NOTEOFF_QUEUE = 16, //output
+            CLICK_ERROR = 17, //output
+            MIDI_CLOCK = 18,
+            RAMP_LENGTH = 19,
+            RAMP_SHAPE = 20,
+            /* controls of the first click layer, those of layer n follow
+             * at n * LAYER_FIELDS */
+            LAYER_RESOLUTION = 21,
+            LAYER_SIZE = 22,
+            LAYER_NOTE = 23,
+            LAYER_CH_OUT = 24,
+            LAYER_GAIN = 25
         };
         enum State {
           STATE_ATTACK, // Envelope rising
@@ -109,50 +189,164 @@ public:
         };
     
         void connect_port(uint32_t port, void *data);
-        void run(uint32_t nframes);
+        template <int outputs> void run(uint32_t nframes);
         void activate();
         void deactivate();
         void updatePosAtom(const LV2_Atom_Object* obj);
+        void updatePatchAtom(const LV2_Atom_Object* obj);
+        LV2_Worker_Status work(LV2_Worker_Respond_Function respond,
+                            LV2_Worker_Respond_Handle handle,
+                            uint32_t size, const void *data);
+        LV2_Worker_Status work_response(uint32_t size, const void *data);
+        LV2_State_Status save(LV2_State_Store_Function store,
+                            LV2_State_Handle handle,
+                            const LV2_Feature *const *features);
+        LV2_State_Status restore(LV2_State_Retrieve_Function retrieve,
+                            LV2_State_Handle handle,
+                            const LV2_Feature *const *features);
         void updatePos(uint64_t position, float bpm, int speed, bool ignore_pos=false);
+        void relocate(uint64_t pos);
         void initTransport();
+        void rampTempo();
         LV2_URID_Map *uridMap;
+        LV2_Worker_Schedule *schedule;  /**< NULL without host worker */
+        bool referenceRun; /**< Render with the per-frame reference loop */
         MidiMetURIs m_uris;
         LV2_Atom_Forge forge;
         LV2_Atom_Forge_Frame m_frame;
 
 private:
 
+        const uint8_t *portMap; /**< Variant port index to full plugin port */
         float *outputPort;
-        float *val[17];
+        float *val[36];
+        float unconnected[36];  /**< Values of ports absent in a variant */
+        /* Control values last read from the input ports. A port is only
+         * applied when it differs, so that a value set through patch:Set
+         * holds until the port changes. */
+        float portValue[36];
+        LV2_URID paramKey[36];  /**< patch:Set property of each field, 0 for none */
+        void applyParam(int field, float value);
+        DspStats dspStats;
+        bool instrumented;      /**< Any of the DspStats ports is connected */
+
+        /* Patterns built by restore(), which may run concurrently with
+         * run(), are handed over through restoredPattern. run() takes the
+         * restored one and leaves the replaced one for the worker or, if
+         * it cannot be scheduled, in a free slot of retiredPatterns, which
+         * the next work(), restore() or the destructor deletes. A new
+         * pattern work_response() can neither apply nor send back to the
+         * worker is dropped into droppedPatterns, freed the same way. */
+        std::atomic<const StepPattern *> restoredPattern;
+        std::atomic<const StepPattern *> retiredPatterns[RETIRE_SLOTS];
+        std::atomic<const StepPattern *> droppedPatterns[RETIRE_SLOTS];
+        /* Program of the last pattern built and the click sample paths,
+         * for save(). Only used by the worker and the state functions,
+         * never by run(). */
+        std::mutex stateMutex;
+        std::string program;
+        void retirePattern(const StepPattern *p);
+        LV2_Worker_Status respondPointer(LV2_Worker_Respond_Function respond,
+                            LV2_Worker_Respond_Handle handle,
+                            LV2_URID type, const void *ptr);
+
+        // Clicks of the main grid and the layers sounding
+        ClickVoices voices;
+#ifndef CONFIG_CLICK_SYNTH
+        // Click waves, shared between instances at the same sample rate
+        const ClickTable *clickTable;
 
-        // One cycle of a sine wave
-        float*   wave_h;
-        float*   wave_l;
-        float*   clock_fm;
-        uint32_t wave_len;        
+        /* Click samples loaded from files, handed over and dropped like
+         * the patterns. Empty ones select the ClickTable waves. */
+        const ClickSamples *clickSamples;   /**< NULL: ClickTable waves */
+        std::atomic<const ClickSamples *> restoredSamples;
+        std::atomic<const ClickSamples *> retiredSamples[RETIRE_SLOTS];
+        std::atomic<const ClickSamples *> droppedSamples[RETIRE_SLOTS];
+        std::string clickPath;          /**< Guarded by stateMutex */
+        std::string accentClickPath;    /**< Guarded by stateMutex */
+        ClickSamples *loadSamples(const std::string& path,
+                            const std::string& accent_path);
+        const ClickSamples *swapSamples(const ClickSamples *s);
+        void retireSamples(const ClickSamples *s);
+#endif
         
+        /* Click layers, which play on the ticks of the main click */
+        ClickLayers layers;
+        void applyLayerParam(int layer, int field, float value);
+        template <int outputs, int mode>
+        void playLayers(uint32_t f);
+
         uint64_t curFrame;
-        uint64_t soundOnFrame;
-        uint64_t tempoChangeTick;
-        uint64_t curTick;
-        uint32_t elapsed_len; // Frames since the start of the last click
+        uint64_t curTick;   /**< Tick of the last event frame, timeshifted */
 
         double internalTempo;
+        int rampBars;       /**< Bars over which internal tempo changes ramp, 0 steps */
+        int rampShape;      /**< RAMP_LINEAR or RAMP_EXPONENTIAL */
         double sampleRate;
         double tempo;
         bool transportAtomReceived;
 
         void updateParams();
+        /* Transport and mute state the run loops are specialized on. It
+         * only changes in updateParams() and updatePos(), so it is fixed
+         * for the duration of a block. */
+        enum RunMode {
+            RUN_ROLLING = 1,    /**< transportSpeed is not zero */
+            RUN_HOST = 2,       /**< hostTransport */
+            RUN_SHIFT_POS = 4,  /**< timeshift_ticks is positive */
+            RUN_MUTED = 8,      /**< isMuted */
+            RUN_MODES = 16
+        };
+        typedef void (MidiMetLV2::*RunFunc)(uint32_t, uint32_t, int32_t);
+        template <int outputs>
+        static const RunFunc* runFuncs(bool perFrame);
+
+        int32_t timeshiftTicks() const;
+        template <int outputs>
+        void runRange(uint32_t start, uint32_t end);
+        template <int outputs, int mode>
+        void runPerFrame(uint32_t start, uint32_t end, int32_t timeshift_ticks);
+        template <int outputs, int mode>
+        void runSegmented(uint32_t start, uint32_t end, int32_t timeshift_ticks);
+        template <int outputs, int mode>
+        void processFrame(uint32_t f, int32_t timeshift_ticks);
+        template <int outputs>
+        void renderSegment(float *output, uint32_t nframes);
+        bool clickSounding();
+        uint32_t framesUntilRawTick(uint64_t tick, uint32_t limit);
+        template <int mode>
+        uint32_t framesUntilTick(uint64_t tick, int32_t timeshift_ticks,
+                                uint32_t limit);
         void forgeMidiEvent(uint32_t f, const uint8_t* const buffer, uint32_t size);
 
-        uint64_t transportFramesDelta;  /**< Frames since last click start */
+        /* MIDI clock output at 24 clocks per beat. The clock runs on the
+         * transport tick minus the timeshift, which unlike the click tick
+         * also applies a positive timeshift from the transport start. */
+        bool clockOut;          /**< MIDI_CLOCK is on */
+        bool clockRunning;      /**< Start or Continue sent or due */
+        int clockPending;       /**< EV_START or EV_CONTINUE due with the next clock, or EV_NONE */
+        uint64_t nextClockTick; /**< Clock timeline tick of the next clock */
+        void updateClock(uint32_t f, int32_t timeshift_ticks);
+        uint32_t framesUntilClock(int32_t timeshift_ticks, uint32_t limit);
+        void sendClock(uint32_t f);
+
+        /* MIDI clock input, the transport of TRANSPORT_MODE 2. The input
+         * clocks set the position, and ClockFollower the tempo at which
+         * the ticks run on to the next clock. */
+        ClockFollower clockIn;
+        bool clockSlave;        /**< Transport follows the MIDI clock input */
+        bool slaveStarting;     /**< Start or Continue received, the transport rolls from the next clock */
+        uint64_t slaveClock;    /**< Song position of the next input clock [clocks] */
+        void updateClockIn(const uint8_t *msg, uint32_t size);
+        void followClock();
+
+        uint64_t transportFramesDelta;  /**< Last transport frame received from the host */
         float transportBpm;
         float transportSpeed;
         bool hostTransport;
         bool tempoFromHost; /**< 0: Internal, 1: Host */
-        uint32_t evQueue[JQ_BUFSZ];
-        uint64_t evTickQueue[JQ_BUFSZ];
-        int bufPtr;
+        bool hostRamp;      /**< The last position atom changed the tempo while rolling */
+        EventQueue<MidiEvent, JQ_BUFSZ> noteOffQueue;
 
         LV2_Atom_Sequence *inEventBuffer;
         const LV2_Atom_Sequence *outEventBuffer;
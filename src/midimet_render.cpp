@@ -0,0 +1,325 @@
+/*!
+ * @file midimet_render.cpp
+ * @brief Renders the click track of a tempo map to WAV and MIDI files
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "clicktrack.h"
+#include "steppattern.h"
+
+/* Segments rendered per job before they are written in order */
+#define SEGMENTS_PER_JOB    4
+
+/* A range of the track, rendered and converted to the sample format of
+ * the WAV file by one job */
+struct Segment {
+    uint64_t frame;
+    uint32_t nframes;
+    std::vector<float> audio;
+    std::vector<uint8_t> data;
+};
+
+static void putLittleEndian(uint8_t *p, uint32_t val, int size)
+{
+    for (int l1 = 0; l1 < size; l1++) p[l1] = (val >> (8 * l1)) & 0xff;
+}
+
+/* Writes the header of a mono WAV file of nframes, in 16 or 24 bit PCM or
+ * in 32 bit float */
+static bool writeWavHeader(FILE *f, uint64_t nframes, double sample_rate,
+                    int bits)
+{
+    const uint32_t data_size = nframes * (bits / 8);
+    const bool is_float = (bits == 32);
+    uint8_t h[58];
+    int len = 0;
+
+    memcpy(h, "RIFF", 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    putLittleEndian(h + 16, (is_float) ? 18 : 16, 4);
+    putLittleEndian(h + 20, (is_float) ? 3 : 1, 2);
+    putLittleEndian(h + 22, 1, 2);
+    putLittleEndian(h + 24, (uint32_t)sample_rate, 4);
+    putLittleEndian(h + 28, (uint32_t)sample_rate * (bits / 8), 4);
+    putLittleEndian(h + 32, bits / 8, 2);
+    putLittleEndian(h + 34, bits, 2);
+    len = 36;
+    if (is_float) {
+        /* no extension, and the frame count required for float */
+        putLittleEndian(h + 36, 0, 2);
+        memcpy(h + 38, "fact", 4);
+        putLittleEndian(h + 42, 4, 4);
+        putLittleEndian(h + 46, nframes, 4);
+        len = 50;
+    }
+    memcpy(h + len, "data", 4);
+    putLittleEndian(h + len + 4, data_size, 4);
+    len += 8;
+    putLittleEndian(h + 4, len - 8 + data_size, 4);
+
+    return (fwrite(h, 1, len, f) == (size_t)len);
+}
+
+static void convert(const float *audio, uint32_t nframes, int bits,
+                    uint8_t *out)
+{
+    if (bits == 32) {
+        for (uint32_t l1 = 0; l1 < nframes; l1++) {
+            uint32_t u;
+            memcpy(&u, audio + l1, 4);
+            putLittleEndian(out + 4 * l1, u, 4);
+        }
+        return;
+    }
+    const int bytes = bits / 8;
+    const float scale = (float)((1 << (bits - 1)) - 1);
+    for (uint32_t l1 = 0; l1 < nframes; l1++) {
+        const float x = std::min(std::max(audio[l1], -1.f), 1.f);
+        putLittleEndian(out + bytes * l1, (uint32_t)(int32_t)lrintf(x * scale),
+                        bytes);
+    }
+}
+
+static void renderSegment(const ClickTrack& track, Segment *seg, int bits)
+{
+    seg->audio.resize(seg->nframes);
+    seg->data.resize((size_t)seg->nframes * (bits / 8));
+    track.render(seg->audio.data(), seg->frame, seg->nframes);
+    convert(seg->audio.data(), seg->nframes, bits, seg->data.data());
+}
+
+/* Renders the track in rounds of segments, each round split among jobs
+ * threads and written in order once all are done */
+static bool renderWav(const ClickTrack& track, FILE *f, int bits, int jobs,
+                    uint32_t segment_frames)
+{
+    std::vector<Segment> segs(jobs * SEGMENTS_PER_JOB);
+    const uint64_t total = track.frames();
+
+    for (uint64_t frame = 0; frame < total; ) {
+        size_t nsegs = 0;
+        while ((nsegs < segs.size()) && (frame < total)) {
+            segs[nsegs].frame = frame;
+            segs[nsegs].nframes = (uint32_t)std::min<uint64_t>(segment_frames,
+                                                        total - frame);
+            frame += segs[nsegs].nframes;
+            nsegs++;
+        }
+
+        std::atomic<size_t> next(0);
+        auto work = [&]() {
+            size_t ix;
+            while ((ix = next++) < nsegs) renderSegment(track, &segs[ix], bits);
+        };
+        if (jobs > 1) {
+            std::vector<std::thread> threads;
+            for (int l1 = 0; l1 < jobs; l1++) threads.emplace_back(work);
+            for (size_t l1 = 0; l1 < threads.size(); l1++) threads[l1].join();
+        }
+        else {
+            work();
+        }
+
+        for (size_t l1 = 0; l1 < nsegs; l1++) {
+            const std::vector<uint8_t>& d = segs[l1].data;
+            if (fwrite(d.data(), 1, d.size(), f) != d.size()) return false;
+        }
+    }
+    return true;
+}
+
+static bool readFile(const char *path, std::string *text)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::ostringstream s;
+    s << in.rdbuf();
+    *text = s.str();
+    return true;
+}
+
+static bool parseIntArg(const char *arg, int min, int max, int *val)
+{
+    char *end;
+    const long v = strtol(arg, &end, 10);
+    if ((end == arg) || *end || (v < min) || (v > max)) return false;
+    *val = (int)v;
+    return true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [options] MAP\n"
+        "  -o FILE   WAV file to write\n"
+        "  -m FILE   Standard MIDI File to write\n"
+        "  -r RATE   sample rate (default 48000)\n"
+        "  -b BITS   WAV sample format, 16, 24 or 32 for float (default 24)\n"
+        "  -d RES    clicks per beat, 1-16 (default 1)\n"
+        "  -p TEXT   step pattern program\n"
+        "  -s BEATS  pattern length in beats (default 4)\n"
+        "  -n NOTE   MIDI note of the plain click (default 57)\n"
+        "  -v VEL    velocity (default 64)\n"
+        "  -l LEN    note length, 0-127 as the plugin control (default 60)\n"
+        "  -c CHAN   MIDI channel, 1-16 (default 1)\n"
+        "  -j JOBS   threads rendering the audio (default all cores)\n"
+        "  -S SEC    length of the segments rendered apart (default 10)\n"
+        "MAP is a text file with one tempo map entry per line:\n"
+        "  BAR BPM [BEATS/UNIT] [ramp BARS [linear|exponential]]\n"
+        "and BAR end as the last line.\n",
+        name);
+}
+
+int main(int argc, char *argv[])
+{
+    ClickTrack track;
+    const char *wav_path = NULL;
+    const char *smf_path = NULL;
+    const char *program = NULL;
+    int rate = 48000;
+    int bits = 24;
+    int jobs = std::max(1u, std::thread::hardware_concurrency());
+    double segment_seconds = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:m:r:b:d:p:s:n:v:l:c:j:S:h")) != -1) {
+        bool ok = true;
+        switch (opt) {
+        case 'o':
+            wav_path = optarg;
+            break;
+        case 'm':
+            smf_path = optarg;
+            break;
+        case 'r':
+            ok = parseIntArg(optarg, 8000, 768000, &rate);
+            break;
+        case 'b':
+            ok = parseIntArg(optarg, 16, 32, &bits) && !(bits % 8);
+            break;
+        case 'd':
+            ok = parseIntArg(optarg, 1, 16, &track.res);
+            break;
+        case 'p':
+            program = optarg;
+            break;
+        case 's':
+            ok = parseIntArg(optarg, 1, 128, &track.size);
+            break;
+        case 'n':
+            ok = parseIntArg(optarg, 0, 115, &track.note);
+            break;
+        case 'v':
+            ok = parseIntArg(optarg, 1, 127, &track.vel);
+            break;
+        case 'l':
+            ok = parseIntArg(optarg, 0, 127, &track.noteLength);
+            break;
+        case 'c':
+            ok = parseIntArg(optarg, 1, 16, &track.channel);
+            track.channel--;
+            break;
+        case 'j':
+            ok = parseIntArg(optarg, 1, 1024, &jobs);
+            break;
+        case 'S':
+            segment_seconds = atof(optarg);
+            ok = (segment_seconds > 0);
+            break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+        if (!ok) {
+            fprintf(stderr, "invalid value for -%c: %s\n", opt, optarg);
+            return 1;
+        }
+    }
+    if ((optind != argc - 1) || (!wav_path && !smf_path)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (track.res * track.size > STEP_MAX) {
+        fprintf(stderr, "pattern longer than %d steps\n", STEP_MAX);
+        return 1;
+    }
+    if (program && !track.setPattern(program)) {
+        fprintf(stderr, "invalid pattern: %s\n", program);
+        return 1;
+    }
+
+    std::string text, error;
+    if (!readFile(argv[optind], &text)) {
+        fprintf(stderr, "cannot read %s\n", argv[optind]);
+        return 1;
+    }
+    if (!track.parseMap(text, error)) {
+        fprintf(stderr, "%s: %s\n", argv[optind], error.c_str());
+        return 1;
+    }
+
+    const auto t0 = std::chrono::steady_clock::now();
+    track.build(rate);
+
+    if (smf_path) {
+        const std::vector<uint8_t> smf = track.smf();
+        FILE *f = fopen(smf_path, "wb");
+        if (!f || (fwrite(smf.data(), 1, smf.size(), f) != smf.size())
+                || fclose(f)) {
+            fprintf(stderr, "cannot write %s\n", smf_path);
+            return 1;
+        }
+    }
+    if (wav_path) {
+        if (track.frames() * (bits / 8) > 0xffffff00ULL) {
+            fprintf(stderr, "track too long for a WAV file\n");
+            return 1;
+        }
+        const uint32_t segment_frames = (uint32_t)std::max(1.,
+                                            std::min(segment_seconds * rate, 1e8));
+        FILE *f = fopen(wav_path, "wb");
+        if (!f || !writeWavHeader(f, track.frames(), rate, bits)
+                || !renderWav(track, f, bits, jobs, segment_frames)
+                || fclose(f)) {
+            fprintf(stderr, "cannot write %s\n", wav_path);
+            return 1;
+        }
+    }
+
+    const double sec = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - t0).count();
+    const double length = (double)track.frames() / rate;
+    fprintf(stderr, "%zu clicks, %.1f s of audio in %.2f s, %.0f times real time\n",
+            track.clicks().size(), length, sec, length / sec);
+    return 0;
+}
@@ -0,0 +1,706 @@
+/*!
+ * @file midimet_rtcheck.cpp
+ * @brief Checks that the plugin audio callbacks are real-time safe
+ *
+ * The tool interposes the memory allocation functions, the pthread lock
+ * functions and common blocking system calls. While the plugin's
+ * activate(), run() or deactivate() executes, any call to one of them is
+ * recorded as a violation, and the tool exits with a non-zero status after
+ * reporting them. It drives the plugin through all transport and parameter
+ * changes handled by updateParams() and updatePosAtom().
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "offlinehost.h"
+
+#ifndef MIDIMET_PLUGIN_PATH
+#define MIDIMET_PLUGIN_PATH "./midimet.so"
+#endif
+
+#define RT_EXPORT __attribute__((visibility("default")))
+#define RT_MAX_VIOLATIONS 64
+
+/* Control port indices */
+#define P_VELOCITY          3
+#define P_NOTELENGTH        4
+#define P_RESOLUTION        5
+#define P_SIZE              6
+#define P_CH_OUT            7
+#define P_MUTE              9
+#define P_TRANSPORT_MODE    10
+#define P_TEMPO_MODE        11
+#define P_TEMPO             12
+#define P_HOST_TEMPO        13
+#define P_HOST_POSITION     14
+#define P_HOST_SPEED        15
+#define P_TIMESHIFT         16
+#define P_MIDI_CLOCK        21
+#define P_RAMP_LENGTH       22
+#define P_RAMP_SHAPE        23
+#define P_LAYER1_RESOLUTION 24
+#define P_LAYER1_GAIN       28
+#define P_LAYER2_SIZE       30
+#define P_LAYER2_GAIN       33
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+/*
+ * Violation recording. The hooks run inside the plugin callbacks, so they
+ * only store the function name and the caller address, which are resolved
+ * and printed once the callback has returned.
+ */
+
+struct Violation {
+    const char *function;
+    void *caller;
+};
+
+static volatile int rtActive = 0;
+static int rtDepth = 0;
+static Violation violations[RT_MAX_VIOLATIONS];
+static int nViolations = 0;
+static int totalViolations = 0;
+
+static inline void rtCheck(const char *function, void *caller)
+{
+    if (!rtActive || rtDepth) return;
+
+    if (nViolations < RT_MAX_VIOLATIONS) {
+        violations[nViolations].function = function;
+        violations[nViolations].caller = caller;
+        nViolations++;
+    }
+    totalViolations++;
+}
+
+/* Looks up the libc implementation of an interposed function. dlsym() may
+ * allocate, which must not count as a violation. */
+static void *realFunction(const char *name)
+{
+    rtDepth++;
+    void *f = dlsym(RTLD_NEXT, name);
+    rtDepth--;
+    if (!f) {
+        static const char msg[] = "midimet_rtcheck: cannot resolve libc function\n";
+        if (write(2, msg, sizeof(msg) - 1) < 0) abort();
+        abort();
+    }
+    return f;
+}
+
+#define RT_CALLER __builtin_return_address(0)
+
+#define RT_HOOK(ret, name, params, args, spec)                          \
+extern "C" RT_EXPORT ret name params spec                               \
+{                                                                       \
+    typedef ret (*Func) params;                                         \
+    static Func real = NULL;                                            \
+    if (!real) real = (Func)realFunction(#name);                        \
+    rtCheck(#name, RT_CALLER);                                          \
+    return real args;                                                   \
+}
+
+/*
+ * Memory allocation
+ */
+
+extern "C" RT_EXPORT void *malloc(size_t size) throw()
+{
+    rtCheck("malloc", RT_CALLER);
+    return __libc_malloc(size);
+}
+
+extern "C" RT_EXPORT void *calloc(size_t nmemb, size_t size) throw()
+{
+    rtCheck("calloc", RT_CALLER);
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" RT_EXPORT void *realloc(void *ptr, size_t size) throw()
+{
+    rtCheck("realloc", RT_CALLER);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" RT_EXPORT void free(void *ptr) throw()
+{
+    if (ptr) rtCheck("free", RT_CALLER);
+    __libc_free(ptr);
+}
+
+extern "C" RT_EXPORT int posix_memalign(void **memptr, size_t alignment,
+                                        size_t size) throw()
+{
+    rtCheck("posix_memalign", RT_CALLER);
+    *memptr = __libc_memalign(alignment, size);
+    return *memptr ? 0 : ENOMEM;
+}
+
+extern "C" RT_EXPORT void *aligned_alloc(size_t alignment, size_t size) throw()
+{
+    rtCheck("aligned_alloc", RT_CALLER);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" RT_EXPORT void *memalign(size_t alignment, size_t size) throw()
+{
+    rtCheck("memalign", RT_CALLER);
+    return __libc_memalign(alignment, size);
+}
+
+static void *newChecked(const char *function, void *caller, size_t size)
+{
+    rtCheck(function, caller);
+    void *p = __libc_malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+RT_EXPORT void *operator new(size_t size)
+{
+    return newChecked("operator new", RT_CALLER, size);
+}
+
+RT_EXPORT void *operator new[](size_t size)
+{
+    return newChecked("operator new[]", RT_CALLER, size);
+}
+
+RT_EXPORT void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    rtCheck("operator new", RT_CALLER);
+    return __libc_malloc(size ? size : 1);
+}
+
+RT_EXPORT void *operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    rtCheck("operator new[]", RT_CALLER);
+    return __libc_malloc(size ? size : 1);
+}
+
+RT_EXPORT void operator delete(void *ptr) noexcept
+{
+    if (ptr) rtCheck("operator delete", RT_CALLER);
+    __libc_free(ptr);
+}
+
+RT_EXPORT void operator delete[](void *ptr) noexcept
+{
+    if (ptr) rtCheck("operator delete[]", RT_CALLER);
+    __libc_free(ptr);
+}
+
+RT_EXPORT void operator delete(void *ptr, size_t) noexcept
+{
+    if (ptr) rtCheck("operator delete", RT_CALLER);
+    __libc_free(ptr);
+}
+
+RT_EXPORT void operator delete[](void *ptr, size_t) noexcept
+{
+    if (ptr) rtCheck("operator delete[]", RT_CALLER);
+    __libc_free(ptr);
+}
+
+/*
+ * Locks and condition variables
+ */
+
+RT_HOOK(int, pthread_mutex_lock, (pthread_mutex_t *m), (m), throw())
+RT_HOOK(int, pthread_mutex_trylock, (pthread_mutex_t *m), (m), throw())
+RT_HOOK(int, pthread_mutex_unlock, (pthread_mutex_t *m), (m), throw())
+RT_HOOK(int, pthread_rwlock_rdlock, (pthread_rwlock_t *l), (l), throw())
+RT_HOOK(int, pthread_rwlock_wrlock, (pthread_rwlock_t *l), (l), throw())
+RT_HOOK(int, pthread_rwlock_unlock, (pthread_rwlock_t *l), (l), throw())
+RT_HOOK(int, pthread_spin_lock, (pthread_spinlock_t *l), (l), throw())
+RT_HOOK(int, pthread_cond_wait, (pthread_cond_t *c, pthread_mutex_t *m),
+        (c, m), )
+RT_HOOK(int, pthread_cond_timedwait, (pthread_cond_t *c, pthread_mutex_t *m,
+        const struct timespec *t), (c, m, t), )
+RT_HOOK(int, pthread_cond_signal, (pthread_cond_t *c), (c), throw())
+RT_HOOK(int, pthread_cond_broadcast, (pthread_cond_t *c), (c), throw())
+RT_HOOK(int, sem_wait, (sem_t *s), (s), )
+RT_HOOK(int, sem_timedwait, (sem_t *s, const struct timespec *t), (s, t), )
+RT_HOOK(int, sem_post, (sem_t *s), (s), throw())
+
+/*
+ * System calls and stdio
+ */
+
+RT_HOOK(ssize_t, read, (int fd, void *buf, size_t n), (fd, buf, n), )
+RT_HOOK(ssize_t, write, (int fd, const void *buf, size_t n), (fd, buf, n), )
+RT_HOOK(int, close, (int fd), (fd), )
+RT_HOOK(off_t, lseek, (int fd, off_t off, int whence), (fd, off, whence), throw())
+RT_HOOK(int, poll, (struct pollfd *fds, nfds_t n, int t), (fds, n, t), )
+RT_HOOK(int, select, (int n, fd_set *r, fd_set *w, fd_set *e,
+        struct timeval *t), (n, r, w, e, t), )
+RT_HOOK(void *, mmap, (void *a, size_t l, int p, int f, int fd, off_t o),
+        (a, l, p, f, fd, o), throw())
+RT_HOOK(int, munmap, (void *a, size_t l), (a, l), throw())
+RT_HOOK(int, mprotect, (void *a, size_t l, int p), (a, l, p), throw())
+RT_HOOK(int, mlock, (const void *a, size_t l), (a, l), throw())
+RT_HOOK(int, nanosleep, (const struct timespec *r, struct timespec *rem),
+        (r, rem), )
+RT_HOOK(int, clock_nanosleep, (clockid_t c, int f, const struct timespec *r,
+        struct timespec *rem), (c, f, r, rem), )
+RT_HOOK(int, usleep, (useconds_t u), (u), )
+RT_HOOK(unsigned int, sleep, (unsigned int s), (s), )
+RT_HOOK(int, sched_yield, (void), (), throw())
+RT_HOOK(FILE *, fopen, (const char *p, const char *m), (p, m), )
+RT_HOOK(int, fclose, (FILE *f), (f), )
+RT_HOOK(size_t, fwrite, (const void *b, size_t s, size_t n, FILE *f),
+        (b, s, n, f), )
+RT_HOOK(size_t, fread, (void *b, size_t s, size_t n, FILE *f), (b, s, n, f), )
+RT_HOOK(int, fputs, (const char *s, FILE *f), (s, f), )
+RT_HOOK(int, puts, (const char *s), (s), )
+RT_HOOK(int, fflush, (FILE *f), (f), )
+RT_HOOK(int, vprintf, (const char *fmt, va_list ap), (fmt, ap), )
+RT_HOOK(int, vfprintf, (FILE *f, const char *fmt, va_list ap), (f, fmt, ap), )
+RT_HOOK(void *, dlopen, (const char *p, int f), (p, f), throw())
+RT_HOOK(int, dlclose, (void *h), (h), throw())
+
+extern "C" RT_EXPORT int open(const char *path, int flags, ...)
+{
+    typedef int (*Func)(const char *, int, ...);
+    static Func real = NULL;
+    mode_t mode = 0;
+
+    if (!real) real = (Func)realFunction("open");
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    rtCheck("open", RT_CALLER);
+    return real(path, flags, mode);
+}
+
+extern "C" RT_EXPORT int openat(int dirfd, const char *path, int flags, ...)
+{
+    typedef int (*Func)(int, const char *, int, ...);
+    static Func real = NULL;
+    mode_t mode = 0;
+
+    if (!real) real = (Func)realFunction("openat");
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    rtCheck("openat", RT_CALLER);
+    return real(dirfd, path, flags, mode);
+}
+
+extern "C" RT_EXPORT int printf(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    rtCheck("printf", RT_CALLER);
+    rtDepth++;
+    const int r = vprintf(fmt, ap);
+    rtDepth--;
+    va_end(ap);
+    return r;
+}
+
+extern "C" RT_EXPORT int fprintf(FILE *f, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    rtCheck("fprintf", RT_CALLER);
+    rtDepth++;
+    const int r = vfprintf(f, fmt, ap);
+    rtDepth--;
+    va_end(ap);
+    return r;
+}
+
+/*
+ * Test driver
+ */
+
+#define PATTERN_URI "https://github.com/emuse/midimet#pattern"
+#define CLICK_URI "https://github.com/emuse/midimet#click"
+#define ACCENT_CLICK_URI "https://github.com/emuse/midimet#accentClick"
+#define VELOCITY_URI "https://github.com/emuse/midimet#velocity"
+#define RESOLUTION_URI "https://github.com/emuse/midimet#resolution"
+#define SIZE_URI "https://github.com/emuse/midimet#size"
+#define TEMPO_URI "https://github.com/emuse/midimet#tempo"
+#define TIMESHIFT_URI "https://github.com/emuse/midimet#timeshift"
+#define MUTE_URI "https://github.com/emuse/midimet#mute"
+
+/* Click sample written by main() */
+static char clickWav[] = "/tmp/midimet_rtcheck_XXXXXX.wav";
+
+/* Keys of the position atom sent by a step, 0 for none */
+#define ATOM_NONE   0
+
+/* One change of controls, host transport, step pattern, click sample or
+ * MIDI clock input, followed by a run of blocks. With repeat set, the position atom is sent in every block
+ * of the step with the frame position advancing, as most hosts do while
+ * rolling. */
+struct RtStep {
+    const char *name;
+    int port;
+    float value;
+    int keys;
+    int64_t pos;
+    float bpm;
+    float speed;
+    bool repeat;
+    const char *pattern;    /**< Step pattern program, or NULL */
+    bool restore;           /**< pattern is restored as state */
+    const char *click;      /**< Path of the click sample, or NULL */
+    const char *accentClick;
+    int realtime;           /**< MIDI message sent first, 0 for none */
+    float clockBpm;         /**< Tempo of the MIDI clock input, 0 for none */
+    const char *param;      /**< Parameter set to value by patch:Set, or NULL */
+};
+
+static const RtStep rtSteps[] = {
+    /* free running, updateParams() */
+    {"free start",          P_TRANSPORT_MODE, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"midi clock",          P_MIDI_CLOCK, 1, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"internal tempo mode", P_TEMPO_MODE, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"internal tempo",      P_TEMPO, 173, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"velocity",            P_VELOCITY, 100, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"note length",         P_NOTELENGTH, 10, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"resolution",          P_RESOLUTION, 12, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"size",                P_SIZE, 19, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"output channel",      P_CH_OUT, 9, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"positive timeshift",  P_TIMESHIFT, 60, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"negative timeshift",  P_TIMESHIFT, -80, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"mute",                P_MUTE, 1, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"unmute",              P_MUTE, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"host tempo mode",     P_TEMPO_MODE, 1, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"internal tempo, host tempo mode", P_TEMPO, 90, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    /* host transport through the designated control ports */
+    {"host transport",      P_TRANSPORT_MODE, 1, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"port tempo",          P_HOST_TEMPO, 140, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"port start",          P_HOST_SPEED, 1, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"port position",       P_HOST_POSITION, 96000, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"port stop",           P_HOST_SPEED, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"internal tempo, host transport", P_TEMPO, 111, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    /* host transport through time:Position atoms, updatePosAtom() */
+    {"atom stopped",        -1, 0, OH_POS_ALL, 0, 120, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom start",          -1, 0, OH_POS_ALL, 0, 120, 1, true, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom relocate",       -1, 0, OH_POS_ALL, 480000, 120, 1, true, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom tempo",          -1, 0, OH_POS_ALL, 480000, 133.5, 1, true, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom speed only",     -1, 0, OH_POS_SPEED, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom tempo only",     -1, 0, OH_POS_BPM, 0, 97.25, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom frame only",     -1, 0, OH_POS_FRAME, 12345, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom bar keys only",  -1, 0, OH_POS_BAR, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom restart",        -1, 0, OH_POS_ALL, 0, 97.25, 1, true, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom timeshift",      P_TIMESHIFT, 45, OH_POS_ALL, 0, 97.25, 1, true, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom mute",           P_MUTE, 1, OH_POS_ALL, 0, 97.25, 1, true, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom resolution",     P_RESOLUTION, 0, OH_POS_ALL, 0, 97.25, 1, true, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"atom stop",           -1, 0, OH_POS_ALL, 0, 97.25, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    /* patch:Set of the step pattern, built by the worker */
+    {"pattern",             -1, 0, ATOM_NONE, 0, 0, 0, false, "A x - x60:100 x:20", false, NULL, NULL, 0, 0, NULL},
+    {"invalid pattern",     -1, 0, ATOM_NONE, 0, 0, 0, false, "A y", false, NULL, NULL, 0, 0, NULL},
+    {"default pattern",     -1, 0, ATOM_NONE, 0, 0, 0, false, "", false, NULL, NULL, 0, 0, NULL},
+    /* the pattern from restore(), handed over to run() */
+    {"restored pattern",    -1, 0, ATOM_NONE, 0, 0, 0, false, "x x A -:90", true, NULL, NULL, 0, 0, NULL},
+    {"restored default",    -1, 0, ATOM_NONE, 0, 0, 0, false, "", true, NULL, NULL, 0, 0, NULL},
+    /* patch:Set of the click samples, loaded by the worker */
+    {"click sample",        -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, clickWav, NULL, 0, 0, NULL},
+    {"accent click sample", -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, clickWav, 0, 0, NULL},
+    {"missing click sample", -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, "/nonexistent.wav", NULL, 0, 0, NULL},
+    {"built-in click",      -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, "", NULL, 0, 0, NULL},
+    /* MIDI clock input, updateClockIn() and followClock() */
+    {"clock slave",         P_TRANSPORT_MODE, 2, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 120, NULL},
+    {"slave start",         -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0xfa, 120, NULL},
+    {"slave tempo",         -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 140, NULL},
+    {"slave stop",          -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0xfc, 140, NULL},
+    {"slave position",      -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0xf2, 140, NULL},
+    {"slave continue",      -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0xfb, 140, NULL},
+    {"slave position atom", -1, 0, OH_POS_ALL, 0, 120, 1, true, NULL, false, NULL, NULL, 0, 140, NULL},
+    {"slave clock lost",    -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"slave clock resumed", -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 95, NULL},
+    {"free again",          P_TRANSPORT_MODE, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"midi clock off",      P_MIDI_CLOCK, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    /* patch:Set of the controls in the middle of the block */
+    {"patch velocity",      -1, 64, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, VELOCITY_URI},
+    {"patch resolution",    -1, 7, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, RESOLUTION_URI},
+    {"patch size",          -1, 3, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, SIZE_URI},
+    {"patch tempo",         -1, 211, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, TEMPO_URI},
+    {"patch tempo clamped", -1, 1e6, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, TEMPO_URI},
+    {"patch timeshift",     -1, -30, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, TIMESHIFT_URI},
+    {"patch mute",          -1, 1, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, MUTE_URI},
+    {"patch unmute",        -1, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, MUTE_URI},
+    /* tempo ramps of the free running transport, rampTicks() */
+    {"ramp length",         P_RAMP_LENGTH, 1, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"linear ramp",         P_TEMPO, 60, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"exponential shape",   P_RAMP_SHAPE, 1, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"exponential ramp",    P_TEMPO, 300, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"patch tempo, ramping", -1, 150, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, TEMPO_URI},
+    {"tempo step",          P_RAMP_LENGTH, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    /* click layers, ClickLayers and mixLayers() */
+    {"layer on",            P_LAYER1_GAIN, 0.8, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"layer resolution",    P_LAYER1_RESOLUTION, 4, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"second layer on",     P_LAYER2_GAIN, 1, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"layer length",        P_LAYER2_SIZE, 2, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+    {"layer off",           P_LAYER1_GAIN, 0, ATOM_NONE, 0, 0, 0, false, NULL, false, NULL, NULL, 0, 0, NULL},
+};
+
+static const int nRtSteps = sizeof(rtSteps) / sizeof(rtSteps[0]);
+
+/* Writes a decaying 1 kHz tone of 50 ms at 22050 Hz as 16 bit WAV file to
+ * clickWav, so that the plugin converts its rate */
+static bool writeClickWav()
+{
+    const uint32_t rate = 22050;
+    const uint32_t nframes = rate / 20;
+    uint8_t header[44];
+    int16_t data[nframes];
+
+    for (uint32_t l1 = 0; l1 < nframes; l1++) {
+        data[l1] = (int16_t)(30000 * exp(-(double)l1 / (nframes / 5))
+                            * sin(2 * M_PI * 1000 * l1 / rate));
+    }
+    /* little endian fields of the RIFF, fmt and data headers */
+    const uint32_t fields[] = {36 + 2 * nframes, 16, (1 << 16) | 1, rate,
+                                2 * rate, (16 << 16) | 2, 2 * nframes};
+    memcpy(header, "RIFF", 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    memcpy(header + 36, "data", 4);
+    const int offsets[] = {4, 16, 20, 24, 28, 32, 40};
+    for (int l1 = 0; l1 < 7; l1++) {
+        for (int l2 = 0; l2 < 4; l2++) {
+            header[offsets[l1] + l2] = fields[l1] >> (8 * l2);
+        }
+    }
+
+    const int fd = mkstemps(clickWav, 4);
+    if (fd < 0) return false;
+    FILE *f = fdopen(fd, "wb");
+    if (!f) return false;
+    bool ok = (fwrite(header, sizeof(header), 1, f) == 1);
+    /* the host is little endian as well */
+    ok &= (fwrite(data, sizeof(data), 1, f) == 1);
+    return (fclose(f) == 0) && ok;
+}
+
+enum { PHASE_ACTIVATE, PHASE_RUN, PHASE_DEACTIVATE };
+static const char *phaseNames[] = {"activate", "run", "deactivate"};
+
+/* URI of the plugin variant under check, for the reports */
+static const char *rtPluginUri = "";
+
+static bool report(int phase, const char *step, uint32_t block_size,
+                    double sample_rate)
+{
+    if (!totalViolations) return true;
+
+    /* the caller is given as module offset for addr2line, the plugin
+     * symbols are hidden */
+    for (int l1 = 0; l1 < nViolations; l1++) {
+        Dl_info info;
+        const char *module = "?";
+        const char *symbol = "";
+        uintptr_t offset = (uintptr_t)violations[l1].caller;
+        if (dladdr(violations[l1].caller, &info)) {
+            module = info.dli_fname;
+            offset -= (uintptr_t)info.dli_fbase;
+            if (info.dli_sname) symbol = info.dli_sname;
+        }
+        fprintf(stderr, "FAIL %s in %s of %s, step \"%s\", block size %u, "
+                "rate %g, called from %s+0x%lx %s\n",
+                violations[l1].function, phaseNames[phase], rtPluginUri, step,
+                block_size, sample_rate, module, (unsigned long)offset, symbol);
+    }
+    if (totalViolations > nViolations) {
+        fprintf(stderr, "FAIL %d more violations\n",
+                totalViolations - nViolations);
+    }
+    nViolations = 0;
+    totalViolations = 0;
+    return false;
+}
+
+static void guarded(int phase, OfflineInstance *inst, uint32_t nframes)
+{
+    rtActive = 1;
+    switch (phase) {
+    case PHASE_ACTIVATE:
+        inst->activate();
+        break;
+    case PHASE_RUN:
+        inst->run(nframes);
+        break;
+    case PHASE_DEACTIVATE:
+        inst->deactivate();
+        break;
+    }
+    rtActive = 0;
+}
+
+/* Runs all steps at the given block size and sample rate, returns false if
+ * any violation occurred */
+static bool checkRun(OfflineHost *host, uint32_t block_size,
+                    double sample_rate, double step_seconds)
+{
+    OfflineInstance inst(host, sample_rate, block_size);
+    if (!inst.valid()) {
+        fprintf(stderr, "instantiation failed\n");
+        return false;
+    }
+
+    bool ok = true;
+    guarded(PHASE_ACTIVATE, &inst, 0);
+    ok &= report(PHASE_ACTIVATE, "", block_size, sample_rate);
+
+    for (int s = 0; s < nRtSteps; s++) {
+        const RtStep& step = rtSteps[s];
+        const uint64_t nframes = (uint64_t)(step_seconds * sample_rate);
+        int64_t pos = step.pos;
+
+        if (step.port >= 0) inst.control[step.port] = step.value;
+        if (step.pattern && step.restore) {
+            inst.restoreString(PATTERN_URI, step.pattern);
+        }
+
+        for (uint64_t f = 0; f < nframes; f += block_size) {
+            inst.beginInput();
+            if (step.keys && (!f || step.repeat)) {
+                const double beats = pos / sample_rate * step.bpm / 60.;
+                inst.addPosition(0, pos, step.bpm, step.speed,
+                                (int64_t)(beats / 4), beats - 4 * (int64_t)(beats / 4),
+                                4, 4, step.keys);
+            }
+            if (step.pattern && !f && !step.restore) {
+                inst.addPatchString(0, PATTERN_URI, step.pattern);
+            }
+            if (step.click && !f) {
+                inst.addPatchPath(0, CLICK_URI, step.click);
+            }
+            if (step.accentClick && !f) {
+                inst.addPatchPath(0, ACCENT_CLICK_URI, step.accentClick);
+            }
+            if (step.param && !f) {
+                inst.addPatchFloat(block_size / 2, step.param, step.value);
+            }
+            if (step.realtime && !f) {
+                /* a Song Position Pointer of 2 bars */
+                const uint8_t msg[3] = {(uint8_t)step.realtime, 32, 0};
+                inst.addMidi(0, msg, (step.realtime == 0xf2) ? 3 : 1);
+            }
+            if (step.clockBpm) {
+                const double period = sample_rate * 60. / (24. * step.clockBpm);
+                const uint8_t f8 = 0xf8;
+                for (uint64_t k = (uint64_t)ceil(f / period);
+                        k * period < f + block_size; k++) {
+                    inst.addMidi((uint32_t)(k * period - f), &f8, 1);
+                }
+            }
+            inst.endInput();
+
+            guarded(PHASE_RUN, &inst, block_size);
+            /* outside the check, as the worker thread of a host */
+            inst.work();
+            if (step.speed) pos += block_size;
+        }
+        /* an empty block is valid as well */
+        inst.beginInput();
+        inst.endInput();
+        guarded(PHASE_RUN, &inst, 0);
+
+        ok &= report(PHASE_RUN, step.name, block_size, sample_rate);
+    }
+
+    guarded(PHASE_DEACTIVATE, &inst, 0);
+    ok &= report(PHASE_DEACTIVATE, "", block_size, sample_rate);
+
+    /* reactivation after deactivate */
+    guarded(PHASE_ACTIVATE, &inst, 0);
+    ok &= report(PHASE_ACTIVATE, "reactivation", block_size, sample_rate);
+    guarded(PHASE_RUN, &inst, block_size);
+    ok &= report(PHASE_RUN, "reactivation", block_size, sample_rate);
+
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = (argc > 1) ? argv[1] : MIDIMET_PLUGIN_PATH;
+    const uint32_t blockSizes[] = {1, 64, 1000, 4096};
+    const double sampleRates[] = {44100, 48000, 96000};
+    bool ok = true;
+
+    if (!writeClickWav()) {
+        fprintf(stderr, "cannot write %s\n", clickWav);
+        return 1;
+    }
+
+    /* the full plugin and the MIDI-only and audio-only variants */
+    for (uint32_t index = 0; index < OH_NDESCS; index++) {
+        OfflineHost host;
+        if (!host.load(path, index)) {
+            fprintf(stderr, "FAIL %s\n", host.error().c_str());
+            ok = false;
+            continue;
+        }
+        rtPluginUri = host.descriptor()->URI;
+
+        /* block path first, then the per frame reference path */
+        for (int ref = 0; ref < 2; ref++) {
+            if (ref) {
+                setenv("MIDIMET_REFERENCE_RUN", "1", 1);
+            }
+            else {
+                unsetenv("MIDIMET_REFERENCE_RUN");
+            }
+            for (size_t r = 0; r < sizeof(sampleRates) / sizeof(double); r++) {
+                for (size_t b = 0; b < sizeof(blockSizes) / sizeof(uint32_t); b++) {
+                    ok &= checkRun(&host, blockSizes[b], sampleRates[r], 0.6);
+                }
+            }
+        }
+    }
+
+    unlink(clickWav);
+    printf("%s: %d steps, %d descriptors, %s\n", path, nRtSteps, OH_NDESCS,
+            ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,428 @@
+/*!
+ * @file offlinehost.cpp
+ * @brief Implements the offline LV2 host used by the midimet tools
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <cstring>
+#include <dlfcn.h>
+#include "offlinehost.h"
+#include "lv2/lv2plug.in/ns/ext/time/time.h"
+#include "lv2/lv2plug.in/ns/ext/patch/patch.h"
+#include "lv2/lv2plug.in/ns/ext/midi/midi.h"
+
+/* Room for the position objects and patches of a block */
+#define OH_INBUF_SIZE   65536
+/* Room for the MIDI events of a block, about 2 per frame at most */
+#define OH_OUTBUF_MIN   8192
+/* Room for the worker requests of a block and their responses */
+#define OH_WORKBUF_SIZE 65536
+/* Each message is preceded by its size and padded, so that messages
+ * holding pointers stay aligned */
+#define OH_MSG_HEADER   8
+#define OH_MSG_PAD(size) (((size) + 7) & ~7)
+
+/* Ports of the MIDI-only and audio-only variants by their index in the
+ * full plugin, as listed in their TTL */
+static const uint8_t midiPorts[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+                                    14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+                                    25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
+                                    36, 37, 38};
+static const uint8_t audioPorts[] = {0, 2, 3, 5, 6, 8, 9, 10, 11, 12, 13, 14,
+                                    15, 16, 17, 18, 19, 20, 22, 23, 24, 25, 28,
+                                    29, 30, 33, 34, 35, 38};
+
+OfflineHost::OfflineHost()
+{
+    module = NULL;
+    desc = NULL;
+    portMap = NULL;
+    nPorts = OH_NPORTS;
+    uridMapFeature.handle = this;
+    uridMapFeature.map = mapUri;
+    mapFeature.URI = LV2_URID__map;
+    mapFeature.data = &uridMapFeature;
+    featureList[0] = &mapFeature;
+    featureList[1] = NULL;
+}
+
+OfflineHost::~OfflineHost()
+{
+    if (module) dlclose(module);
+}
+
+bool OfflineHost::load(const char *path, uint32_t index)
+{
+    typedef const LV2_Descriptor *(*DescriptorFunc)(uint32_t);
+
+    module = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!module) {
+        errorString = dlerror();
+        return false;
+    }
+
+    DescriptorFunc descriptorFunc = (DescriptorFunc)dlsym(module, "lv2_descriptor");
+    if (!descriptorFunc) {
+        errorString = std::string(path) + ": no lv2_descriptor symbol";
+        return false;
+    }
+
+    desc = descriptorFunc(index);
+    if (!desc) {
+        errorString = std::string(path) + ": no descriptor at index "
+                        + std::to_string(index);
+        return false;
+    }
+    if (index == OH_DESC_MIDI) {
+        portMap = midiPorts;
+        nPorts = sizeof(midiPorts);
+    }
+    else if (index == OH_DESC_AUDIO) {
+        portMap = audioPorts;
+        nPorts = sizeof(audioPorts);
+    }
+    return true;
+}
+
+LV2_URID OfflineHost::map(const char *uri)
+{
+    for (size_t l1 = 0; l1 < uris.size(); l1++) {
+        if (uris[l1] == uri) return l1 + 1;
+    }
+    uris.push_back(uri);
+    return uris.size();
+}
+
+LV2_URID OfflineHost::mapUri(LV2_URID_Map_Handle handle, const char *uri)
+{
+    return ((OfflineHost *)handle)->map(uri);
+}
+
+OfflineInstance::OfflineInstance(OfflineHost *host, double sample_rate,
+                                uint32_t max_block)
+{
+    /* TTL defaults */
+    const float defaults[OH_NPORTS] = {0, 0, 0, 64, 60, 0, 3, 0, 0, 0, 0, 1,
+                                        120, 120, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                        2, 3, 60, 0, 0, 2, 3, 62, 0, 0,
+                                        2, 3, 64, 0, 0};
+
+    this->host = host;
+    active = false;
+    for (int l1 = 0; l1 < OH_NPORTS; l1++) control[l1] = defaults[l1];
+
+    audioBuffer.assign(max_block, 0.0f);
+    inBuffer.assign(OH_INBUF_SIZE / sizeof(uint64_t), 0);
+    outBuffer.assign((OH_OUTBUF_MIN + 32 * max_block) / sizeof(uint64_t), 0);
+
+    uris.time_Position = host->map(LV2_TIME__Position);
+    uris.time_frame = host->map(LV2_TIME__frame);
+    uris.time_speed = host->map(LV2_TIME__speed);
+    uris.time_beatsPerMinute = host->map(LV2_TIME__beatsPerMinute);
+    uris.time_bar = host->map(LV2_TIME__bar);
+    uris.time_barBeat = host->map(LV2_TIME__barBeat);
+    uris.time_beatsPerBar = host->map(LV2_TIME__beatsPerBar);
+    uris.time_beatUnit = host->map(LV2_TIME__beatUnit);
+    uris.patch_Set = host->map(LV2_PATCH__Set);
+    uris.patch_property = host->map(LV2_PATCH__property);
+    uris.patch_value = host->map(LV2_PATCH__value);
+    uris.atom_String = host->map(LV2_ATOM__String);
+    uris.atom_Path = host->map(LV2_ATOM__Path);
+    uris.midi_MidiEvent = host->map(LV2_MIDI__MidiEvent);
+    lv2_atom_forge_init(&forge, host->uridMap());
+
+    requests.assign(OH_WORKBUF_SIZE, 0);
+    responses.assign(OH_WORKBUF_SIZE, 0);
+    requestsLen = 0;
+    responsesLen = 0;
+    scheduleData.handle = this;
+    scheduleData.schedule_work = scheduleWork;
+    scheduleFeature.URI = LV2_WORKER__schedule;
+    scheduleFeature.data = &scheduleData;
+    featureList[0] = host->features()[0];
+    featureList[1] = &scheduleFeature;
+    featureList[2] = NULL;
+
+    const LV2_Descriptor *desc = host->descriptor();
+    worker = NULL;
+    state = NULL;
+    if (desc->extension_data) {
+        worker = (const LV2_Worker_Interface *)
+                    desc->extension_data(LV2_WORKER__interface);
+        state = (const LV2_State_Interface *)
+                    desc->extension_data(LV2_STATE__interface);
+    }
+    handle = desc->instantiate(desc, sample_rate, "",
+                            (worker) ? featureList : host->features());
+    if (!handle) return;
+
+    /* control holds the ports of the full plugin, those a variant lacks
+     * are left unconnected */
+    for (uint32_t l1 = 0; l1 < host->ports(); l1++) {
+        const uint32_t port = host->fullPort(l1);
+        if (port == OH_PORT_AUDIO_OUT) {
+            desc->connect_port(handle, l1, audioBuffer.data());
+        }
+        else if (port == OH_PORT_MIDI_OUT) {
+            desc->connect_port(handle, l1, outBuffer.data());
+        }
+        else if (port == OH_PORT_MIDI_IN) {
+            desc->connect_port(handle, l1, inBuffer.data());
+        }
+        else {
+            desc->connect_port(handle, l1, &control[port]);
+        }
+    }
+
+    beginInput();
+    endInput();
+}
+
+OfflineInstance::~OfflineInstance()
+{
+    if (!handle) return;
+
+    deactivate();
+    host->descriptor()->cleanup(handle);
+}
+
+void OfflineInstance::activate()
+{
+    if (active) return;
+
+    if (host->descriptor()->activate) host->descriptor()->activate(handle);
+    active = true;
+}
+
+void OfflineInstance::deactivate()
+{
+    if (!active) return;
+
+    if (host->descriptor()->deactivate) host->descriptor()->deactivate(handle);
+    active = false;
+}
+
+void OfflineInstance::beginInput()
+{
+    lv2_atom_forge_set_buffer(&forge, (uint8_t *)inBuffer.data(),
+                                inBuffer.size() * sizeof(uint64_t));
+    lv2_atom_forge_sequence_head(&forge, &seqFrame, 0);
+}
+
+void OfflineInstance::addPosition(uint32_t frame, int64_t pos, float bpm,
+                    float speed, int64_t bar, float barBeat,
+                    float beatsPerBar, int beatUnit, int keys)
+{
+    LV2_Atom_Forge_Frame frame_obj;
+
+    lv2_atom_forge_frame_time(&forge, frame);
+    lv2_atom_forge_object(&forge, &frame_obj, 0, uris.time_Position);
+    if (keys & OH_POS_FRAME) {
+        lv2_atom_forge_key(&forge, uris.time_frame);
+        lv2_atom_forge_long(&forge, pos);
+    }
+    if (keys & OH_POS_SPEED) {
+        lv2_atom_forge_key(&forge, uris.time_speed);
+        lv2_atom_forge_float(&forge, speed);
+    }
+    if (keys & OH_POS_BPM) {
+        lv2_atom_forge_key(&forge, uris.time_beatsPerMinute);
+        lv2_atom_forge_float(&forge, bpm);
+    }
+    if (keys & OH_POS_BAR) {
+        lv2_atom_forge_key(&forge, uris.time_bar);
+        lv2_atom_forge_long(&forge, bar);
+        lv2_atom_forge_key(&forge, uris.time_barBeat);
+        lv2_atom_forge_float(&forge, barBeat);
+        lv2_atom_forge_key(&forge, uris.time_beatsPerBar);
+        lv2_atom_forge_float(&forge, beatsPerBar);
+        lv2_atom_forge_key(&forge, uris.time_beatUnit);
+        lv2_atom_forge_int(&forge, beatUnit);
+    }
+    lv2_atom_forge_pop(&forge, &frame_obj);
+}
+
+void OfflineInstance::addPatchString(uint32_t frame, const char *property,
+                    const char *value)
+{
+    addPatch(frame, property, uris.atom_String, value);
+}
+
+void OfflineInstance::addPatchPath(uint32_t frame, const char *property,
+                    const char *path)
+{
+    addPatch(frame, property, uris.atom_Path, path);
+}
+
+void OfflineInstance::addPatchFloat(uint32_t frame, const char *property,
+                    float value)
+{
+    LV2_Atom_Forge_Frame frame_obj;
+
+    lv2_atom_forge_frame_time(&forge, frame);
+    lv2_atom_forge_object(&forge, &frame_obj, 0, uris.patch_Set);
+    lv2_atom_forge_key(&forge, uris.patch_property);
+    lv2_atom_forge_urid(&forge, host->map(property));
+    lv2_atom_forge_key(&forge, uris.patch_value);
+    lv2_atom_forge_float(&forge, value);
+    lv2_atom_forge_pop(&forge, &frame_obj);
+}
+
+void OfflineInstance::addPatch(uint32_t frame, const char *property,
+                    LV2_URID type, const char *value)
+{
+    LV2_Atom_Forge_Frame frame_obj;
+
+    lv2_atom_forge_frame_time(&forge, frame);
+    lv2_atom_forge_object(&forge, &frame_obj, 0, uris.patch_Set);
+    lv2_atom_forge_key(&forge, uris.patch_property);
+    lv2_atom_forge_urid(&forge, host->map(property));
+    lv2_atom_forge_key(&forge, uris.patch_value);
+    lv2_atom_forge_typed_string(&forge, type, value, strlen(value));
+    lv2_atom_forge_pop(&forge, &frame_obj);
+}
+
+void OfflineInstance::addMidi(uint32_t frame, const uint8_t *msg,
+                    uint32_t size)
+{
+    lv2_atom_forge_frame_time(&forge, frame);
+    lv2_atom_forge_atom(&forge, size, uris.midi_MidiEvent);
+    lv2_atom_forge_write(&forge, msg, size);
+}
+
+void OfflineInstance::endInput()
+{
+    lv2_atom_forge_pop(&forge, &seqFrame);
+}
+
+void OfflineInstance::run(uint32_t nframes)
+{
+    /* the output sequence size tells the plugin its capacity */
+    LV2_Atom *out = (LV2_Atom *)outBuffer.data();
+    out->size = outBuffer.size() * sizeof(uint64_t) - sizeof(LV2_Atom);
+    out->type = 0;
+
+    host->descriptor()->run(handle, nframes);
+
+    if (!worker) return;
+
+    /* the responses of the work done since the last block, the plugin may
+     * schedule more work from these */
+    size_t len = responsesLen;
+    responsesLen = 0;
+    for (size_t pos = 0; pos < len; ) {
+        uint32_t size;
+        memcpy(&size, &responses[pos], sizeof(size));
+        worker->work_response(handle, size, &responses[pos + OH_MSG_HEADER]);
+        pos += OH_MSG_HEADER + OH_MSG_PAD(size);
+    }
+    if (worker->end_run) worker->end_run(handle);
+}
+
+bool OfflineInstance::restoreString(const char *key, const char *value)
+{
+    if (!state) return false;
+
+    StringProperty prop = {this, host->map(key), value};
+    return (state->restore(handle, retrieveString, &prop, 0,
+                            host->features()) == LV2_STATE_SUCCESS);
+}
+
+std::string OfflineInstance::saveString(const char *key)
+{
+    if (!state) return std::string();
+
+    StringProperty prop = {this, host->map(key), std::string()};
+    state->save(handle, storeString, &prop, LV2_STATE_IS_POD
+                | LV2_STATE_IS_PORTABLE, host->features());
+    return prop.value;
+}
+
+const void *OfflineInstance::retrieveString(LV2_State_Handle handle,
+                    uint32_t key, size_t *size, uint32_t *type,
+                    uint32_t *flags)
+{
+    StringProperty *prop = (StringProperty *)handle;
+
+    if (key != prop->key) return NULL;
+    *size = prop->value.size() + 1;
+    *type = prop->inst->uris.atom_String;
+    *flags = LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE;
+    return prop->value.c_str();
+}
+
+LV2_State_Status OfflineInstance::storeString(LV2_State_Handle handle,
+                    uint32_t key, const void *value, size_t size,
+                    uint32_t type, uint32_t)
+{
+    StringProperty *prop = (StringProperty *)handle;
+
+    if ((key == prop->key) && (type == prop->inst->uris.atom_String)
+            && size) {
+        prop->value.assign((const char *)value, size - 1);
+    }
+    return LV2_STATE_SUCCESS;
+}
+
+int OfflineInstance::work()
+{
+    if (!worker) return 0;
+
+    /* requests scheduled by work() itself are done in the next call */
+    std::vector<uint8_t> pending(requests.begin(),
+                                requests.begin() + requestsLen);
+    requestsLen = 0;
+
+    int count = 0;
+    for (size_t pos = 0; pos < pending.size(); count++) {
+        uint32_t size;
+        memcpy(&size, &pending[pos], sizeof(size));
+        worker->work(handle, respond, this, size, &pending[pos + OH_MSG_HEADER]);
+        pos += OH_MSG_HEADER + OH_MSG_PAD(size);
+    }
+    return count;
+}
+
+LV2_Worker_Status OfflineInstance::queue(std::vector<uint8_t>& buf,
+                                size_t& len, uint32_t size, const void *data)
+{
+    if (len + OH_MSG_HEADER + OH_MSG_PAD(size) > buf.size()) {
+        return LV2_WORKER_ERR_NO_SPACE;
+    }
+    memcpy(&buf[len], &size, sizeof(size));
+    memcpy(&buf[len + OH_MSG_HEADER], data, size);
+    len += OH_MSG_HEADER + OH_MSG_PAD(size);
+    return LV2_WORKER_SUCCESS;
+}
+
+LV2_Worker_Status OfflineInstance::scheduleWork(
+                    LV2_Worker_Schedule_Handle handle, uint32_t size,
+                    const void *data)
+{
+    OfflineInstance *inst = (OfflineInstance *)handle;
+    return queue(inst->requests, inst->requestsLen, size, data);
+}
+
+LV2_Worker_Status OfflineInstance::respond(LV2_Worker_Respond_Handle handle,
+                    uint32_t size, const void *data)
+{
+    OfflineInstance *inst = (OfflineInstance *)handle;
+    return queue(inst->responses, inst->responsesLen, size, data);
+}
@@ -0,0 +1,232 @@
+/*!
+ * @file offlinehost.h
+ * @brief Defines a minimal offline LV2 host for the midimet tools
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef OFFLINEHOST_H
+#define OFFLINEHOST_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "lv2/lv2plug.in/ns/lv2core/lv2.h"
+#include "lv2/lv2plug.in/ns/ext/urid/urid.h"
+#include "lv2/lv2plug.in/ns/ext/atom/forge.h"
+#include "lv2/lv2plug.in/ns/ext/worker/worker.h"
+#include "lv2/lv2plug.in/ns/ext/state/state.h"
+
+/* Port indices of the full midimet plugin */
+#define OH_PORT_AUDIO_OUT   0
+#define OH_PORT_MIDI_OUT    1
+#define OH_PORT_MIDI_IN     2
+#define OH_PORT_CONTROL     3
+#define OH_NPORTS           39
+
+/* Descriptor indices of the full, the MIDI-only and the audio-only plugin */
+#define OH_DESC_FULL    0
+#define OH_DESC_MIDI    1
+#define OH_DESC_AUDIO   2
+#define OH_NDESCS       3
+
+/* Keys sent by OfflineInstance::addPosition() */
+#define OH_POS_FRAME    1
+#define OH_POS_SPEED    2
+#define OH_POS_BPM      4
+#define OH_POS_BAR      8   /**< bar, barBeat, beatsPerBar and beatUnit */
+#define OH_POS_ALL      15
+
+/*! @brief Loads the midimet plugin module and provides the host features
+ * it requires.
+ *
+ * The module is opened with dlopen() and its descriptor is looked up
+ * through lv2_descriptor(), as a real host does. The urid:map feature is a
+ * plain list of URIs, which is sufficient for the handful of URIs the
+ * plugin maps at instantiation.
+ */
+class OfflineHost {
+
+  public:
+    OfflineHost();
+    ~OfflineHost();
+
+/*! @brief opens the plugin module at path and looks up descriptor index,
+ * one of OH_DESC_FULL, OH_DESC_MIDI and OH_DESC_AUDIO
+ *
+ * @return False if the module or the descriptor cannot be found, the
+ * reason is available from OfflineHost::error()
+ */
+    bool load(const char *path, uint32_t index = OH_DESC_FULL);
+    const LV2_Descriptor *descriptor() const { return desc; }
+/*! @brief returns the number of ports of the loaded descriptor */
+    uint32_t ports() const { return nPorts; }
+/*! @brief returns the index in the full plugin of port of the loaded
+ * descriptor */
+    uint32_t fullPort(uint32_t port) const
+        { return (portMap) ? portMap[port] : port; }
+    const LV2_Feature *const *features() const { return featureList; }
+    const std::string& error() const { return errorString; }
+
+    LV2_URID map(const char *uri);
+    LV2_URID_Map *uridMap() { return &uridMapFeature; }
+
+  private:
+    void *module;
+    const LV2_Descriptor *desc;
+    const uint8_t *portMap;     /**< NULL for the full plugin */
+    uint32_t nPorts;
+    std::vector<std::string> uris;
+    std::string errorString;
+    LV2_URID_Map uridMapFeature;
+    LV2_Feature mapFeature;
+    const LV2_Feature *featureList[2];
+
+    static LV2_URID mapUri(LV2_URID_Map_Handle handle, const char *uri);
+};
+
+/*! @brief A plugin instance with all ports connected to host buffers.
+ *
+ * The control values are in OfflineInstance::control, indexed by port
+ * number. Each block, the input sequence is filled with
+ * OfflineInstance::beginInput(), OfflineInstance::addPosition() and
+ * OfflineInstance::endInput() before OfflineInstance::run() is called.
+ *
+ * The instance provides the worker feature. Work scheduled by the plugin
+ * is queued in preallocated buffers and done by OfflineInstance::work(),
+ * which stands in for the worker thread of a host. The responses are
+ * delivered at the end of the following OfflineInstance::run().
+ */
+class OfflineInstance {
+
+  public:
+    OfflineInstance(OfflineHost *host, double sample_rate,
+                    uint32_t max_block);
+    ~OfflineInstance();
+
+    bool valid() const { return (handle != NULL); }
+    void activate();
+    void deactivate();
+
+    void beginInput();
+    void addPosition(uint32_t frame, int64_t pos, float bpm, float speed,
+                    int64_t bar, float barBeat, float beatsPerBar,
+                    int beatUnit, int keys = OH_POS_ALL);
+    void endInput();
+/*! @brief adds a patch:Set of property to a string value to the input
+ * sequence
+ */
+    void addPatchString(uint32_t frame, const char *property,
+                    const char *value);
+/*! @brief adds a patch:Set of property to a path value to the input
+ * sequence
+ */
+    void addPatchPath(uint32_t frame, const char *property,
+                    const char *path);
+/*! @brief adds a patch:Set of property to a float value to the input
+ * sequence
+ */
+    void addPatchFloat(uint32_t frame, const char *property, float value);
+/*! @brief adds a MIDI message of size bytes to the input sequence */
+    void addMidi(uint32_t frame, const uint8_t *msg, uint32_t size);
+    void run(uint32_t nframes);
+/*! @brief restores a state holding only the string value for key
+ *
+ * @return False if the plugin has no state interface or refuses the state
+ */
+    bool restoreString(const char *key, const char *value);
+/*! @brief saves the plugin state and returns the string value of key, or
+ * an empty string if the state has none
+ */
+    std::string saveString(const char *key);
+/*! @brief does the work the plugin has scheduled so far
+ *
+ * @return Number of requests done
+ */
+    int work();
+
+    const float *audio() const { return audioBuffer.data(); }
+    const LV2_Atom_Sequence *midiOut() const
+        { return (const LV2_Atom_Sequence *)outBuffer.data(); }
+
+    float control[OH_NPORTS];
+
+  private:
+    OfflineHost *host;
+    LV2_Handle handle;
+    bool active;
+    std::vector<float> audioBuffer;
+    /* atom buffers as uint64_t for the 8 byte alignment of sequences */
+    std::vector<uint64_t> inBuffer;
+    std::vector<uint64_t> outBuffer;
+    LV2_Atom_Forge forge;
+    LV2_Atom_Forge_Frame seqFrame;
+
+    const LV2_Worker_Interface *worker;
+    const LV2_State_Interface *state;
+    LV2_Worker_Schedule scheduleData;
+    LV2_Feature scheduleFeature;
+    const LV2_Feature *featureList[3];
+    /* size prefixed messages, allocated once as the plugin schedules work
+     * from run() */
+    std::vector<uint8_t> requests, responses;
+    size_t requestsLen, responsesLen;
+
+    void addPatch(uint32_t frame, const char *property, LV2_URID type,
+                    const char *value);
+    static LV2_Worker_Status queue(std::vector<uint8_t>& buf, size_t& len,
+                                uint32_t size, const void *data);
+    static LV2_Worker_Status scheduleWork(LV2_Worker_Schedule_Handle handle,
+                                uint32_t size, const void *data);
+    static LV2_Worker_Status respond(LV2_Worker_Respond_Handle handle,
+                                uint32_t size, const void *data);
+
+    /* the single property of restoreString() and saveString() */
+    struct StringProperty {
+        OfflineInstance *inst;
+        LV2_URID key;
+        std::string value;
+    };
+    static const void *retrieveString(LV2_State_Handle handle, uint32_t key,
+                                size_t *size, uint32_t *type, uint32_t *flags);
+    static LV2_State_Status storeString(LV2_State_Handle handle, uint32_t key,
+                                const void *value, size_t size, uint32_t type,
+                                uint32_t flags);
+
+    struct {
+        LV2_URID time_Position;
+        LV2_URID time_frame;
+        LV2_URID time_speed;
+        LV2_URID time_beatsPerMinute;
+        LV2_URID time_bar;
+        LV2_URID time_barBeat;
+        LV2_URID time_beatsPerBar;
+        LV2_URID time_beatUnit;
+        LV2_URID patch_Set;
+        LV2_URID patch_property;
+        LV2_URID patch_value;
+        LV2_URID atom_String;
+        LV2_URID atom_Path;
+        LV2_URID midi_MidiEvent;
+    } uris;
+};
+
+#endif
@@ -0,0 +1,123 @@
+/*!
+ * @file steppattern.cpp
+ * @brief Implements the StepPattern table of per-step click settings
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include "steppattern.h"
+
+static bool isSpace(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+}
+
+/* Reads a decimal number of at most three digits, returns -1 if there is
+ * none */
+static int readNumber(const char *&p, const char *end)
+{
+    int val = -1;
+    int ndigits = 0;
+
+    while (p < end && *p >= '0' && *p <= '9' && ndigits < 3) {
+        val = ((val < 0) ? 0 : val * 10) + (*p - '0');
+        p++;
+        ndigits++;
+    }
+    return val;
+}
+
+/* Reads one step token at p into step, returns false on a syntax error */
+static bool readStep(const char *&p, const char *end, Step *step,
+                    int base_note)
+{
+    step->note = base_note;
+    step->velocity = 0;
+    step->accent = false;
+    step->muted = false;
+
+    switch (*p++) {
+        case 'A': step->accent = true; break;
+        case 'x': break;
+        case '-': step->muted = true; break;
+        default: return false;
+    }
+
+    if (p < end && *p >= '0' && *p <= '9') {
+        step->note = readNumber(p, end);
+        if (step->note > 127) return false;
+    }
+    if (p < end && *p == ':') {
+        p++;
+        step->velocity = readNumber(p, end);
+        if (step->velocity < 1 || step->velocity > 127) return false;
+    }
+    return (p == end || isSpace(*p));
+}
+
+StepPattern::StepPattern(int base_note)
+{
+    baseNote = base_note;
+    clear();
+}
+
+void StepPattern::clear()
+{
+    const Step plain = {baseNote, 0, false, false};
+
+    for (int l1 = 0; l1 < STEP_MAX; l1++) steps[l1] = plain;
+    steps[0].accent = true;
+    programmed = false;
+    program.clear();
+}
+
+bool StepPattern::parse(const char *text, uint32_t len)
+{
+    const char *end = text + len;
+    const char *p;
+    Step step;
+    int nsteps = 0;
+
+    /* validate first, so that a bad program leaves the table as it is */
+    for (p = text; p < end; ) {
+        if (isSpace(*p)) {
+            p++;
+            continue;
+        }
+        if (nsteps == STEP_MAX || !readStep(p, end, &step, baseNote)) {
+            return false;
+        }
+        nsteps++;
+    }
+
+    clear();
+    if (!nsteps) return true;
+
+    nsteps = 0;
+    for (p = text; p < end; ) {
+        if (isSpace(*p)) {
+            p++;
+            continue;
+        }
+        readStep(p, end, &steps[nsteps++], baseNote);
+    }
+    programmed = true;
+    program.assign(text, len);
+    return true;
+}
@@ -0,0 +1,81 @@
+/*!
+ * @file steppattern.h
+ * @brief Defines the StepPattern table of per-step click settings
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+
+#ifndef STEPPATTERN_H
+#define STEPPATTERN_H
+
+#include <cstdint>
+#include <string>
+
+/* Largest pattern, 16 steps per beat over 128 beats */
+#define STEP_MAX        2048
+
+/*! @brief Settings of one click of the pattern */
+struct Step {
+    int note;       /*!< MIDI note, an accent plays it an octave higher up to note 115 */
+    int velocity;   /*!< 1 to 127, 0 follows the velocity control */
+    bool accent;
+    bool muted;
+};
+
+/*! @brief Table of the settings of each pattern step, indexed by
+ * MidiMet::framePtr.
+ *
+ * The table always holds STEP_MAX steps, so that it stays valid whatever
+ * resolution and size the pattern has, and the step of a click is a single
+ * load. Steps the program does not cover play the plain click.
+ *
+ * A program is a text of whitespace separated steps. Each step starts
+ * with 'A' for an accented click, 'x' for a plain click or '-' for a
+ * muted step, optionally followed by a note number and by ':' and a
+ * velocity, e.g. "A x x60 x:40 - x". The empty program accents the first
+ * step, which is the default pattern.
+ *
+ * Tables are built outside the audio thread and handed to it complete.
+ */
+class StepPattern {
+
+  public:
+    Step steps[STEP_MAX];
+    bool programmed;        /*!< False for the default pattern */
+    std::string program;    /*!< Text the table was built from */
+
+    explicit StepPattern(int base_note);
+
+/*! @brief rebuilds the table from program text
+ *
+ * @param text Program text, need not be null terminated
+ * @param len Length of text
+ * @return False if the text is not a valid program, the table is then
+ * unchanged
+ */
+    bool parse(const char *text, uint32_t len);
+
+  private:
+    int baseNote;
+
+    void clear();
+};
+
+#endif
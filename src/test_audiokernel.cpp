@@ -0,0 +1,156 @@
+/*!
+ * @file test_audiokernel.cpp
+ * @brief Checks that all audio kernel variants give the scalar output
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "audiokernel.h"
+
+/* The kernel is selected when the program is loaded, so each variant is
+ * run in a child process started with MIDIMET_KERNEL set, which writes
+ * the name of the variant in use and the raw output of the suite below
+ * to its standard output. */
+#define DUMP_ARG        "--dump"
+
+#define MAX_OFFSET      8       /* Misalignments of the buffers in floats */
+#define MAX_FRAMES      68      /* Lengths 0 to MAX_FRAMES - 1 */
+#define GUARD_FRAMES    16      /* Frames past the end that must be kept */
+#define BUFFER_FRAMES   (MAX_OFFSET + MAX_FRAMES + GUARD_FRAMES)
+
+static const char *const variants[] = {"scalar", "sse", "avx", "neon"};
+static const float gains[] = {1.f, 0.7071f, -3.25f, 1e-30f, 0.f};
+
+/* Fills buf with values of mixed sign and magnitude, denormals included */
+static void fill(float *buf, uint32_t seed)
+{
+    for (int l1 = 0; l1 < BUFFER_FRAMES; l1++) {
+        seed = seed * 1664525 + 1013904223;
+        const float mant = (float)(seed >> 8) / (1 << 24) - 0.5f;
+        const int exp = (int)(seed % 7) * 10 - 40;
+        buf[l1] = (l1 % 11) ? ldexpf(mant, exp) : 1e-40f * mant;
+    }
+}
+
+/* Runs the kernels over all offsets and lengths and writes the whole
+ * output buffers, guard frames included */
+static void dumpSuite(FILE *out)
+{
+    float src[BUFFER_FRAMES];
+    float dst[BUFFER_FRAMES];
+    const int ngains = sizeof(gains) / sizeof(float);
+
+    for (int offset = 0; offset < MAX_OFFSET; offset++) {
+        const int src_offset = (offset * 3 + 1) % MAX_OFFSET;
+        for (uint32_t nframes = 0; nframes < MAX_FRAMES; nframes++) {
+            for (int l1 = 0; l1 < ngains; l1++) {
+                const uint32_t seed = (offset * MAX_FRAMES + nframes) * ngains + l1;
+                fill(src, seed);
+                fill(dst, ~seed);
+                audioScaleCopy(dst + offset, src + src_offset, gains[l1], nframes);
+                fwrite(dst, sizeof(dst), 1, out);
+
+                fill(dst, ~seed);
+                audioScaleAdd(dst + offset, src + src_offset, gains[l1], nframes);
+                fwrite(dst, sizeof(dst), 1, out);
+            }
+            fill(dst, nframes);
+            audioZero(dst + offset, nframes);
+            fwrite(dst, sizeof(dst), 1, out);
+        }
+    }
+}
+
+/* Runs path with DUMP_ARG and MIDIMET_KERNEL set to variant, and returns
+ * its output in dump */
+static bool runVariant(const char *path, const char *variant,
+                    std::string *dump)
+{
+    int fd[2];
+    if (pipe(fd)) return false;
+
+    const pid_t pid = fork();
+    if (pid < 0) return false;
+    if (!pid) {
+        close(fd[0]);
+        dup2(fd[1], STDOUT_FILENO);
+        setenv("MIDIMET_KERNEL", variant, 1);
+        execl(path, path, DUMP_ARG, (char *)NULL);
+        _exit(127);
+    }
+
+    close(fd[1]);
+    char buf[65536];
+    ssize_t n;
+    dump->clear();
+    while ((n = read(fd[0], buf, sizeof(buf))) > 0) dump->append(buf, n);
+    close(fd[0]);
+
+    int status;
+    return (waitpid(pid, &status, 0) == pid) && WIFEXITED(status)
+            && !WEXITSTATUS(status);
+}
+
+int main(int argc, char *argv[])
+{
+    if ((argc > 1) && !strcmp(argv[1], DUMP_ARG)) {
+        printf("%s\n", audioKernelName());
+        dumpSuite(stdout);
+        return 0;
+    }
+
+    const int nvariants = sizeof(variants) / sizeof(char *);
+    std::string scalar;
+    std::string tested;
+    bool ok = true;
+
+    for (int l1 = 0; l1 < nvariants; l1++) {
+        const std::string name = std::string(variants[l1]) + "\n";
+        std::string dump;
+        if (!runVariant(argv[0], variants[l1], &dump)) {
+            fprintf(stderr, "FAIL %s: cannot run %s\n", variants[l1], argv[0]);
+            ok = false;
+            continue;
+        }
+        /* variants not built or not supported by the CPU fall back */
+        if (dump.compare(0, name.size(), name)) continue;
+
+        if (!l1) {
+            scalar = dump.substr(name.size());
+        }
+        else if (dump.compare(name.size(), std::string::npos, scalar)) {
+            fprintf(stderr, "FAIL %s: output differs from scalar\n",
+                    variants[l1]);
+            ok = false;
+        }
+        tested += (tested.empty()) ? variants[l1] : std::string(", ") + variants[l1];
+    }
+    if (scalar.empty()) ok = false;
+
+    printf("audiokernel: %s, %s\n", (tested.empty()) ? "none" : tested.c_str(),
+            ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
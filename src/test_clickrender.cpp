@@ -0,0 +1,164 @@
+/*!
+ * @file test_clickrender.cpp
+ * @brief Checks ClickTrack ranges rendered apart against the whole track
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "clicktrack.h"
+
+/* Tempo ramps of both shapes and time signature changes, so that the
+ * clicks fall on frames off any regular grid */
+static const char *const tempoMap =
+    "1  120    4/4\n"
+    "3  97.25  7/8 ramp 2 exponential\n"
+    "6  174.75 5/4 ramp 1\n"
+    "8  61     3/4 ramp 2\n"
+    "10 133.5  4/4\n"
+    "11 end\n";
+
+struct RenderCase {
+    double sampleRate;
+    int res;
+    const char *pattern;    /*!< NULL for the default pattern */
+};
+
+static const RenderCase renderCases[] = {
+    {44100, 3, NULL},
+    {48000, 4, "A x60 x:40 - x x:1 A -"},
+    {96000, 16, NULL},
+};
+
+/* Segment lengths, cycled, from single frames to longer than a click */
+static const uint32_t segmentFrames[] = {1, 2, 3, 7, 61, 64, 127, 509, 4093};
+
+/* Renders the track in the segments split at bounds, last one first */
+static void renderSplit(const ClickTrack& track,
+                    const std::vector<uint64_t>& bounds, float *output)
+{
+    for (size_t l1 = bounds.size() - 1; l1 > 0; l1--) {
+        track.render(output + bounds[l1 - 1], bounds[l1 - 1],
+                    bounds[l1] - bounds[l1 - 1]);
+    }
+}
+
+/* Returns the first frame at which out differs from whole, or total */
+static uint64_t firstDiff(const std::vector<float>& whole,
+                    const std::vector<float>& out, uint64_t total)
+{
+    for (uint64_t l1 = 0; l1 < total; l1++) {
+        if (memcmp(&whole[l1], &out[l1], sizeof(float))) return l1;
+    }
+    return total;
+}
+
+static bool runCase(const RenderCase& rc, uint64_t *nsegments)
+{
+    ClickTrack track;
+    std::string error;
+
+    track.res = rc.res;
+    if (!track.parseMap(tempoMap, error)
+            || (rc.pattern && !track.setPattern(rc.pattern))) {
+        fprintf(stderr, "FAIL %g Hz: invalid map or pattern %s\n",
+                rc.sampleRate, error.c_str());
+        return false;
+    }
+    track.build(rc.sampleRate);
+
+    const uint64_t total = track.frames();
+    std::vector<float> whole(total);
+    track.render(whole.data(), 0, total);
+
+    bool silent = true;
+    for (uint64_t l1 = 0; (l1 < total) && silent; l1++) {
+        silent = !whole[l1];
+    }
+    if (track.clicks().empty() || silent) {
+        fprintf(stderr, "FAIL %g Hz: no clicks rendered\n", rc.sampleRate);
+        return false;
+    }
+
+    /* segments of the cycled lengths */
+    const int nlengths = sizeof(segmentFrames) / sizeof(uint32_t);
+    std::vector<uint64_t> bounds(1, 0);
+    for (int l1 = 0; bounds.back() < total; l1++) {
+        const uint64_t next = bounds.back() + segmentFrames[l1 % nlengths];
+        bounds.push_back((next < total) ? next : total);
+    }
+    /* segments ending on, just before and just after each click */
+    std::vector<uint64_t> click_bounds(1, 0);
+    const std::vector<Click>& clicks = track.clicks();
+    for (size_t l1 = 0; l1 < clicks.size(); l1++) {
+        const uint64_t first = (clicks[l1].frame) ? clicks[l1].frame - 1 : 0;
+        for (uint64_t frame = first; frame <= clicks[l1].frame + 1; frame++) {
+            if ((frame > click_bounds.back()) && (frame < total)) {
+                click_bounds.push_back(frame);
+            }
+        }
+    }
+    click_bounds.push_back(total);
+
+    const std::vector<uint64_t> *splits[] = {&bounds, &click_bounds};
+    const char *const names[] = {"odd lengths", "click frames"};
+    for (int l1 = 0; l1 < 2; l1++) {
+        std::vector<float> out(total, 1.f);
+        renderSplit(track, *splits[l1], out.data());
+        const uint64_t at = firstDiff(whole, out, total);
+        if (at < total) {
+            fprintf(stderr, "FAIL %g Hz, resolution %d, split at %s: frame "
+                    "%llu is %g, whole track %g\n", rc.sampleRate, rc.res,
+                    names[l1], (unsigned long long)at, out[at], whole[at]);
+            return false;
+        }
+        *nsegments += splits[l1]->size() - 1;
+    }
+
+    /* a range starting inside the track, with a click sounding into it */
+    const uint64_t start = clicks[clicks.size() / 3].frame + 17;
+    std::vector<float> out(total - start);
+    track.render(out.data(), start, total - start);
+    if (memcmp(out.data(), whole.data() + start,
+                (total - start) * sizeof(float))) {
+        fprintf(stderr, "FAIL %g Hz, resolution %d: range from frame %llu "
+                "differs from the whole track\n", rc.sampleRate, rc.res,
+                (unsigned long long)start);
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    const int ncases = sizeof(renderCases) / sizeof(RenderCase);
+    uint64_t nsegments = 0;
+    bool ok = true;
+
+    for (int l1 = 0; l1 < ncases; l1++) {
+        ok = runCase(renderCases[l1], &nsegments) && ok;
+    }
+
+    printf("clickrender: %d cases, %llu segments, %s\n", ncases,
+            (unsigned long long)nsegments, ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
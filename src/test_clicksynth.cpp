@@ -0,0 +1,112 @@
+/*!
+ * @file test_clicksynth.cpp
+ * @brief Checks the ClickSynth output against the ClickTable waves
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "clicksynth.h"
+#include "clicktable.h"
+
+/* Largest difference of the synthesized click to the wavetable */
+#define SYNTH_TOLERANCE     1e-5
+
+/* Odd block length, so that the click crosses many block boundaries */
+#define BLOCK_FRAMES        61
+
+static const double sampleRates[] = {44100, 48000, 96000, 192000};
+static const int velocities[] = {127, 64, 1};
+
+/* Renders the click in blocks and compares it with wave up to the end
+ * of the synthesized click, and with silence after it, where the wave
+ * must be below CLICK_CULL_LEVEL */
+static bool checkClick(const ClickTable *table, ClickSynth *synth,
+                    bool accent, int vel)
+{
+    const float *wave = (accent) ? table->waveH : table->waveL;
+    std::vector<float> out(table->len);
+    double max_diff = 0;
+    uint32_t at = 0;
+
+    synth->trigger(accent);
+    for (uint32_t frame = 0; frame < table->len; frame += BLOCK_FRAMES) {
+        uint32_t nframes = table->len - frame;
+        if (nframes > BLOCK_FRAMES) nframes = BLOCK_FRAMES;
+        synth->render(out.data() + frame, nframes, vel);
+    }
+
+    for (uint32_t l1 = 0; l1 < table->len; l1++) {
+        const double ref = (double)wave[l1] * vel / 128;
+        if (l1 < synth->end) {
+            const double diff = fabs(out[l1] - ref);
+            if (diff > max_diff) {
+                max_diff = diff;
+                at = l1;
+            }
+        }
+        else if ((out[l1] != 0) || (fabs(ref) >= CLICK_CULL_LEVEL)) {
+            fprintf(stderr, "FAIL %g Hz, %s click, velocity %d: frame %u "
+                    "past the end at %u is %g, wave %g\n", table->sampleRate,
+                    (accent) ? "accented" : "normal", vel, l1, synth->end,
+                    out[l1], ref);
+            return false;
+        }
+    }
+    if (max_diff > SYNTH_TOLERANCE) {
+        fprintf(stderr, "FAIL %g Hz, %s click, velocity %d: differs by %g "
+                "at frame %u\n", table->sampleRate,
+                (accent) ? "accented" : "normal", vel, max_diff, at);
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    const int nrates = sizeof(sampleRates) / sizeof(double);
+    const int nvels = sizeof(velocities) / sizeof(int);
+    int nclicks = 0;
+    bool ok = true;
+
+    for (int l1 = 0; l1 < nrates; l1++) {
+        const ClickTable *table = ClickTable::acquire(sampleRates[l1]);
+        ClickSynth synth;
+        synth.init(sampleRates[l1]);
+        if (synth.len != table->len) {
+            fprintf(stderr, "FAIL %g Hz: %u frames, wavetable %u\n",
+                    sampleRates[l1], synth.len, table->len);
+            ok = false;
+        }
+        else {
+            for (int l2 = 0; l2 < nvels; l2++) {
+                ok = checkClick(table, &synth, true, velocities[l2]) && ok;
+                ok = checkClick(table, &synth, false, velocities[l2]) && ok;
+                nclicks += 2;
+            }
+        }
+        ClickTable::release(table);
+    }
+
+    printf("clicksynth: %d clicks at %d sample rates, %s\n", nclicks, nrates,
+            ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
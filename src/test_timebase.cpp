@@ -0,0 +1,213 @@
+/*!
+ * @file test_timebase.cpp
+ * @brief Checks the MidiMet timebase against the exact click grid over 24 hours
+ *
+ *
+ *      Copyright 2009 - 2026 <qmidiarp-devel@lists.sourceforge.net>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ *
+ */
+#include <cstdint>
+#include <cstdio>
+#include "midimet.h"
+
+#define TEST_HOURS  24
+
+/* A transport running for TEST_HOURS. The tempos are exact fractions
+ * num / den, so that the ideal frame of each click is an integer
+ * computation. With relocate set, the host sets a new position every
+ * hour, alternating between the two tempos, as updatePos() does. */
+struct GridCase {
+    uint64_t num[2], den[2];
+    uint64_t sampleRate;
+    int res;
+    bool relocate;
+};
+
+static const GridCase gridCases[] = {
+    {{120, 120}, {1, 1}, 48000, 4, false},
+    {{267, 267}, {2, 2}, 192000, 16, false},      /* 133.5 BPM */
+    {{389, 389}, {4, 4}, 44100, 3, false},        /* 97.25 BPM */
+    {{699, 60}, {4, 1}, 96000, 12, true},         /* 174.75 and 60 BPM */
+    {{1001, 85}, {8, 1}, 88200, 16, true},        /* 125.125 and 85 BPM */
+};
+
+/* First frame at or after the exact position of tick, for the transport
+ * at tick anchor_tick at frame anchor_frame */
+static uint64_t idealFrame(const GridCase& gc, int ix, uint64_t anchor_frame,
+                    uint64_t anchor_tick, uint64_t tick)
+{
+    /* frames per tick are 60 * sampleRate * den / (TPQN * num), the
+     * products stay below 2^63 for 24 hours at 192 kHz */
+    const uint64_t a = 60 * gc.sampleRate * gc.den[ix];
+    const uint64_t b = (uint64_t)TPQN * gc.num[ix];
+    return anchor_frame + ((tick - anchor_tick) * a + b - 1) / b;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+    while (b) {
+        const uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* A transport changing tempo every hour through reanchorTicks(), as the
+ * plugin does on host tempo changes, at frames off the click grid. The
+ * exact tick reached at each change is carried as a fraction over the
+ * common denominator of both tick rates. */
+struct ReanchorCase {
+    uint64_t num[2], den[2];
+    uint64_t sampleRate;
+    int res;
+};
+
+static const ReanchorCase reanchorCases[] = {
+    {{267, 389}, {2, 4}, 48000, 16},        /* 133.5 and 97.25 BPM */
+    {{120, 699}, {1, 4}, 44100, 12},        /* 120 and 174.75 BPM */
+    {{1001, 85}, {8, 1}, 96000, 3},         /* 125.125 and 85 BPM */
+};
+
+static bool runReanchorCase(const ReanchorCase& rc, uint64_t *nclicks)
+{
+    MidiMet met;
+    const uint64_t hour_frames = 3600 * rc.sampleRate;
+    const uint64_t click_ticks = TPQN / rc.res;
+    uint64_t step[2], div[2];
+
+    /* ticks per frame are TPQN * num / (60 * sampleRate * den) */
+    for (int l1 = 0; l1 < 2; l1++) {
+        step[l1] = (uint64_t)TPQN * rc.num[l1];
+        div[l1] = 60 * rc.sampleRate * rc.den[l1];
+        const uint64_t g = gcd(step[l1], div[l1]);
+        step[l1] /= g;
+        div[l1] /= g;
+    }
+    const uint64_t lcd = div[0] / gcd(div[0], div[1]) * div[1];
+
+    /* exact tick at anchor_frame times lcd */
+    uint64_t anchor_frame = 0;
+    uint64_t anchor_exact = 0;
+    met.setTickRate((double)rc.num[0] / rc.den[0], rc.sampleRate);
+    met.anchorTicks(0, 0);
+
+    for (int hour = 0; hour < TEST_HOURS; hour++) {
+        const int ix = hour % 2;
+        /* the next change, a prime number of frames past the hour */
+        const uint64_t next_frame = (hour + 1) * hour_frames
+                                    + (hour * 7919) % 104729 + 1;
+        const uint64_t ticks_per_lcd = lcd / div[ix];
+
+        uint64_t tick = (anchor_exact + lcd - 1) / lcd;
+        tick = (tick + click_ticks - 1) / click_ticks * click_ticks;
+        for (;; tick += click_ticks) {
+            /* first frame at or after the exact position of tick */
+            const uint64_t num = (tick * lcd - anchor_exact) * div[ix];
+            const uint64_t den = step[ix] * lcd;
+            const uint64_t ideal = anchor_frame + (num + den - 1) / den;
+            if (ideal >= next_frame) break;
+
+            const uint64_t frame = met.frameAtTick(tick);
+            if ((frame != ideal) || (met.tickAtFrame(frame) < tick)
+                    || ((frame > anchor_frame)
+                        && (met.tickAtFrame(frame - 1) >= tick))) {
+                fprintf(stderr, "FAIL %g BPM at %llu Hz, hour %d after "
+                        "reanchoring: click at tick %llu on frame %llu, "
+                        "ideal %llu\n", (double)rc.num[ix] / rc.den[ix],
+                        (unsigned long long)rc.sampleRate, hour,
+                        (unsigned long long)tick, (unsigned long long)frame,
+                        (unsigned long long)ideal);
+                return false;
+            }
+            (*nclicks)++;
+        }
+
+        anchor_exact += (next_frame - anchor_frame) * step[ix] * ticks_per_lcd;
+        anchor_frame = next_frame;
+        met.reanchorTicks(next_frame, (double)rc.num[1 - ix] / rc.den[1 - ix],
+                        rc.sampleRate);
+    }
+    return true;
+}
+
+static bool runCase(const GridCase& gc, uint64_t *nclicks)
+{
+    MidiMet met;
+    const uint64_t hour_frames = 3600 * gc.sampleRate;
+    const uint64_t click_ticks = TPQN / gc.res;
+    uint64_t anchor_frame = 0;
+    uint64_t anchor_tick = 0;
+    int ix = 0;
+
+    for (int hour = 0; hour < TEST_HOURS; hour++) {
+        const uint64_t hour_start = hour * hour_frames;
+        if (!hour || gc.relocate) {
+            if (hour) {
+                /* the host places the position on the tick reached */
+                anchor_tick = met.tickAtFrame(hour_start);
+                anchor_frame = hour_start;
+                ix = hour % 2;
+            }
+            met.setTickRate((double)gc.num[ix] / gc.den[ix], gc.sampleRate);
+            met.anchorTicks(anchor_frame, anchor_tick);
+        }
+
+        uint64_t tick = (met.tickAtFrame(hour_start) + click_ticks - 1)
+                        / click_ticks * click_ticks;
+        for (;; tick += click_ticks) {
+            const uint64_t ideal = idealFrame(gc, ix, anchor_frame,
+                                            anchor_tick, tick);
+            if (ideal >= hour_start + hour_frames) break;
+
+            const uint64_t frame = met.frameAtTick(tick);
+            if ((frame != ideal) || (met.tickAtFrame(frame) < tick)
+                    || (frame && (met.tickAtFrame(frame - 1) >= tick))) {
+                fprintf(stderr, "FAIL %g BPM at %llu Hz, hour %d: click at "
+                        "tick %llu on frame %llu, ideal %llu\n",
+                        (double)gc.num[ix] / gc.den[ix],
+                        (unsigned long long)gc.sampleRate, hour,
+                        (unsigned long long)tick, (unsigned long long)frame,
+                        (unsigned long long)ideal);
+                return false;
+            }
+            (*nclicks)++;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    const int ngrid = sizeof(gridCases) / sizeof(GridCase);
+    const int nreanchor = sizeof(reanchorCases) / sizeof(ReanchorCase);
+    const int ncases = ngrid + nreanchor;
+    uint64_t nclicks = 0;
+    bool ok = true;
+
+    for (int l1 = 0; l1 < ngrid; l1++) {
+        ok = runCase(gridCases[l1], &nclicks) && ok;
+    }
+    for (int l1 = 0; l1 < nreanchor; l1++) {
+        ok = runReanchorCase(reanchorCases[l1], &nclicks) && ok;
+    }
+
+    printf("timebase: %d cases, %llu clicks over %d hours, %s\n", ncases,
+            (unsigned long long)nclicks, TEST_HOURS, ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}